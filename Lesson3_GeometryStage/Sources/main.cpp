@@ -6,15 +6,27 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cmath>
 #include <memory>
 #include <vector>
 #include <iostream>
 #include "teapot.h"
+#include "random.h"
 //=============================================================================
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+const float SIM_TICK_RATE = 60.0f;              // fixed simulation steps per second
+const uint32_t SIM_MAX_STEPS_PER_FRAME = 4;     // beyond this a slow frame drops sim time
+const uint64_t RANDOM_SEED = 0x5eed;            // same seed, same run
+
+// random streams, so draws made for different things never overlap
+enum : uint32_t
+{
+    RANDOM_PROP_SPAWN,
+    RANDOM_PROP_BOUNCE,
+};
 
 //=============================================================================
 
@@ -125,7 +137,8 @@ struct Object
 {
     Object() = default;
     virtual ~Object() = default;
-    virtual void Update( float const deltaTime ) = 0;
+    virtual void Update( float const deltaTime ) = 0;       // once per rendered frame
+    virtual void Simulate( float const /*tickTime*/ ) {}     // once per fixed simulation tick
     virtual void Render() = 0;
 };
 
@@ -133,16 +146,18 @@ struct Object
 
 struct Prop : public Object
 {
-    Prop( const std::shared_ptr<Mesh>& mesh );
+    Prop( const std::shared_ptr<Mesh>& mesh, uint32_t const id );
     virtual ~Prop() = default;
-    virtual void Update( float const deltaTime ) override;
+    virtual void Update( float const /*deltaTime*/ ) override {}
+    virtual void Simulate( float const tickTime ) override;
     virtual void Render() override;
 
     std::shared_ptr<Mesh> mMesh;
-    glm::mat4 mTransform;
     glm::vec3 mColor;
     glm::vec2 mPosXZ;
+    glm::vec2 mPrevPosXZ;
     glm::vec2 mVelocityXZ;
+    uint32_t mId;
 };
 
 //=============================================================================
@@ -190,6 +205,8 @@ struct GameState
     uint32_t mButtonMask;
     glm::vec2 mPrevMousePos;
     glm::vec2 mCurMousePos;
+    uint64_t mTick;         // simulation ticks so far
+    float mInterpolation;   // render blend between the last two sim ticks
     bool mPauseKey;
     bool mPaused;
 };
@@ -288,42 +305,36 @@ void Mesh::Render( const glm::mat4& modelMatrix, const glm::vec3& color )
 
 //=============================================================================
 
-Prop::Prop( const std::shared_ptr<Mesh>& mesh ):
-    mMesh( mesh )
+Prop::Prop( const std::shared_ptr<Mesh>& mesh, uint32_t const id ):
+    mMesh( mesh ),
+    mId( id )
 {
-    mPosXZ.x = -10.0f + ((float)(rand() % 101) / 100.0f * 20.0f);
-    mPosXZ.y = -10.0f + ((float)(rand() % 101) / 100.0f * 20.0f);
-    mVelocityXZ.x = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-    mVelocityXZ.y = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
+    Random rng( RANDOM_SEED, RANDOM_PROP_SPAWN, 0, mId );
+    mPosXZ.x = -10.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 20.0f);
+    mPosXZ.y = -10.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 20.0f);
+    mVelocityXZ.x = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+    mVelocityXZ.y = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
     mVelocityXZ = glm::normalize( mVelocityXZ );
-    mColor = gColors[rand() % gNumColors];
+    mColor = gColors[rng.NextBelow( gNumColors )];
+    mPrevPosXZ = mPosXZ;
 }
 
 //=============================================================================
 
-void Prop::Update( float const deltaTime )
+void Prop::Simulate( float const tickTime )
 {
-    if (gGameState->mPaused)
-        return;
-
     float const speed = 2.5f;  // meters per second
-    mPosXZ += mVelocityXZ * deltaTime * speed;
+    mPrevPosXZ = mPosXZ;
+    mPosXZ += mVelocityXZ * tickTime * speed;
     if (mPosXZ.x < -10.0f || mPosXZ.x > 10.0f ||
         mPosXZ.y < -10.0f || mPosXZ.y > 10.0f)
     {
-        mVelocityXZ.x = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-        mVelocityXZ.y = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
+        Random rng( RANDOM_SEED, RANDOM_PROP_BOUNCE, gGameState->mTick, mId );
+        mVelocityXZ.x = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+        mVelocityXZ.y = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
         mVelocityXZ = glm::normalize( mVelocityXZ );
         mPosXZ = glm::clamp( mPosXZ, -10.0f, 10.0f );
     }
-
-    glm::mat4 rot = glm::lookAt( glm::vec3( 0.0f, 0.0f, 0.0f ), glm::vec3( mVelocityXZ.x, 0.0f, mVelocityXZ.y ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
-    rot = glm::inverse( rot );
-
-    mTransform = glm::mat4( 1.0f );
-    mTransform = glm::translate( mTransform, glm::vec3( mPosXZ.x, 0.5f, mPosXZ.y ) );
-    mTransform *= rot;
-    mTransform = glm::scale( mTransform, glm::vec3( 0.01f, 0.01f, 0.01f ) );
 }
 
 //=============================================================================
@@ -332,7 +343,18 @@ void Prop::Render()
 {
     if (mMesh != nullptr)
     {
-        mMesh->Render( mTransform, mColor );
+        // draw at the interpolated position between the last two ticks
+        glm::vec2 const posXZ = glm::mix( mPrevPosXZ, mPosXZ, gGameState->mInterpolation );
+
+        glm::mat4 rot = glm::lookAt( glm::vec3( 0.0f, 0.0f, 0.0f ), glm::vec3( mVelocityXZ.x, 0.0f, mVelocityXZ.y ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+        rot = glm::inverse( rot );
+
+        glm::mat4 transform = glm::mat4( 1.0f );
+        transform = glm::translate( transform, glm::vec3( posXZ.x, 0.5f, posXZ.y ) );
+        transform *= rot;
+        transform = glm::scale( transform, glm::vec3( 0.01f, 0.01f, 0.01f ) );
+
+        mMesh->Render( transform, mColor );
     }
 }
 
@@ -484,6 +506,8 @@ bool Init()
     gGameState->mCurMousePos.x = (float)xpos;
     gGameState->mCurMousePos.y = (float)ypos;
 
+    gGameState->mTick = 0;
+    gGameState->mInterpolation = 1.0f;
     gGameState->mPauseKey = false;
     gGameState->mPaused = false;
 
@@ -685,6 +709,18 @@ void Update( float const deltaTime )
 
 //=============================================================================
 
+void Simulate( float const tickTime )
+{
+    // advance the simulation by one fixed tick
+    for (const auto& obj : gGameState->mObjects)
+    {
+        obj->Simulate( tickTime );
+    }
+    gGameState->mTick++;
+}
+
+//=============================================================================
+
 void Render()
 {
     //glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
@@ -746,19 +782,39 @@ int main()
     uint32_t const numProps = 100;
     for (uint32_t i = 0; i < numProps; i++)
     {
-        gGameState->mObjects.push_back( std::shared_ptr<Object>( new Prop( propMesh ) ) );
+        gGameState->mObjects.push_back( std::shared_ptr<Object>( new Prop( propMesh, i ) ) );
     }
 
     // game loop
     // -----------
+    float const tickTime = 1.0f / SIM_TICK_RATE;
+    double accumulator = 0.0;
     double t0 = glfwGetTime();
     while (!glfwWindowShouldClose(gGameState->mWindow))
     {
         // update
         double const t1 = glfwGetTime();
         Update( (float)(t1 - t0) );
+        if (!gGameState->mPaused)
+        {
+            accumulator += t1 - t0;
+        }
         t0 = t1;
 
+        // simulate in fixed ticks; after a hitch drop whatever the step cap can't absorb
+        uint32_t steps = 0;
+        while (accumulator >= tickTime && steps < SIM_MAX_STEPS_PER_FRAME)
+        {
+            Simulate( tickTime );
+            accumulator -= tickTime;
+            steps++;
+        }
+        if (accumulator >= tickTime)
+        {
+            accumulator = std::fmod( accumulator, (double)tickTime );
+        }
+        gGameState->mInterpolation = (float)(accumulator / tickTime);
+
         // render objects (View Frustum Culling, Occlusion Culling, Draw Order Sorting, etc)
         Render();
     }
@@ -0,0 +1,42 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//====================================================
+
+#version 430 core
+
+//====================================================
+
+// GpuCulling::PYRAMID_GROUP_SIZE
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// the depth buffer copy for level 0, the pyramid itself for the others
+uniform sampler2D source;
+uniform int sourceLevel;
+layout (r32f, binding = 0) uniform writeonly image2D destination;
+
+//====================================================
+
+void main()
+{
+    // Max of the 2x2 source texels below, plus the odd last row or column at the edge.
+    ivec2 size = imageSize( destination );
+    ivec2 texel = ivec2( gl_GlobalInvocationID.xy );
+    if (any( greaterThanEqual( texel, size ) ))
+        return;
+    ivec2 sourceLast = textureSize( source, sourceLevel ) - 1;
+    ivec2 first = min( texel * 2, sourceLast );
+    ivec2 last = min( texel * 2 + 1, sourceLast );
+    last.x = texel.x == size.x - 1 ? sourceLast.x : last.x;
+    last.y = texel.y == size.y - 1 ? sourceLast.y : last.y;
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+    {
+        for (int x = first.x; x <= last.x; x++)
+        {
+            depth = max( depth, texelFetch( source, ivec2( x, y ), sourceLevel ).r );
+        }
+    }
+    imageStore( destination, texel, vec4( depth ) );
+}
+
+//====================================================
@@ -0,0 +1,51 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//====================================================
+
+#version 430 core
+
+//====================================================
+
+// one command per thread, GpuCulling::GROUP_SIZE
+layout (local_size_x = 64) in;
+
+// DrawElementsIndirectCommand in geometryarena.h
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// visible per model, from gpucull.cs
+layout (std430, binding = 2) readonly buffer Counts
+{
+    uint counts[];
+};
+
+layout (std430, binding = 4) buffer Commands
+{
+    DrawCommand commands[];
+};
+
+// model whose count each command draws, 0xffffffff to leave the command as it is
+layout (std430, binding = 5) readonly buffer CommandModels
+{
+    uint commandModels[];
+};
+
+uniform int commandCount;
+
+//====================================================
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint( commandCount ) || commandModels[i] == 0xffffffffu)
+        return;
+    commands[i].instanceCount = counts[commandModels[i]];
+}
+
+//====================================================
@@ -0,0 +1,129 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//====================================================
+
+#version 430 core
+
+//====================================================
+
+// one instance per thread, GpuCulling::GROUP_SIZE
+layout (local_size_x = 64) in;
+
+const uint MAX_MODELS = 8u;     // GpuCullParams::MAX_MODELS
+
+// every instance, grouped by model: x, z, heading (radians), scale
+layout (std430, binding = 0) readonly buffer Instances
+{
+    vec4 instances[];
+};
+
+// the visible ones, each model's packed at the start of its range
+layout (std430, binding = 1) writeonly buffer Visible
+{
+    vec4 visible[];
+};
+
+// visible per model, zeroed by the CPU
+layout (std430, binding = 2) buffer Counts
+{
+    uint counts[];
+};
+
+// std430 like GpuCullParams in gpuculling.h
+layout (std430, binding = 3) readonly buffer Params
+{
+    mat4 prevViewProjection;
+    vec4 planes[6];             // facing inwards, normalized
+    vec4 modelSpheres[MAX_MODELS];
+    uint instanceCount;
+    uint modelCount;
+    uint hiZ;                   // 1 if the pyramid holds the previous frame
+    uint pad;
+    uint modelFirst[MAX_MODELS + 1u];
+};
+
+// max depth of the previous frame, level 0 at half its size
+uniform sampler2D pyramid;
+
+//====================================================
+
+bool isOccluded( vec3 center, float radius )
+{
+    // Screen rect and nearest depth of the sphere's box, where the previous frame saw it.
+    vec2 rectMin = vec2( 1.0 );
+    vec2 rectMax = vec2( 0.0 );
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = center + radius * vec3( (i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0 );
+        vec4 clip = prevViewProjection * vec4( corner, 1.0 );
+        if (clip.w <= 1e-4 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min( rectMin, ndc.xy * 0.5 + 0.5 );
+        rectMax = max( rectMax, ndc.xy * 0.5 + 0.5 );
+        nearest = min( nearest, ndc.z * 0.5 + 0.5 );
+    }
+    if (any( greaterThanEqual( rectMin, vec2( 1.0 ) ) ) || any( lessThanEqual( rectMax, vec2( 0.0 ) ) ))
+        return false;
+    rectMin = clamp( rectMin, 0.0, 1.0 );
+    rectMax = clamp( rectMax, 0.0, 1.0 );
+
+    // In depth buffer pixels; level 0 halves an odd size down, so the rect reaches a pixel further.
+    // Texel t of level l covers pixels t * 2^(l + 1) on, and each level's last texel all the rest.
+    // The level is where the rect spans about two texels a side.
+    // Level sizes come from level 0, as glTexStorage2D made them, since the level varies by thread.
+    int levels = textureQueryLevels( pyramid );
+    ivec2 levelZero = textureSize( pyramid, 0 );
+    vec2 depthSize = vec2( levelZero * 2 );
+    vec2 pixelMin = rectMin * depthSize;
+    vec2 pixelMax = rectMax * depthSize + 1.0;
+    vec2 extent = (pixelMax - pixelMin) * 0.5;
+    int level = clamp( int( ceil( log2( max( max( extent.x, extent.y ), 1.0 ) ) ) ), 0, levels - 1 );
+    ivec2 size = max( levelZero >> level, ivec2( 1 ) );
+    ivec2 first = min( ivec2( pixelMin ) >> (level + 1), size - 1 );
+    ivec2 last = min( ivec2( pixelMax ) >> (level + 1), size - 1 );
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+    {
+        for (int x = first.x; x <= last.x; x++)
+        {
+            farthest = max( farthest, texelFetch( pyramid, ivec2( x, y ), level ).r );
+        }
+    }
+    return nearest > farthest;
+}
+
+//====================================================
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= instanceCount)
+        return;
+    uint model = 0u;
+    while (model + 1u < modelCount && i >= modelFirst[model + 1u])
+    {
+        model++;
+    }
+
+    // the model's sphere in world space, rotated like rotateHeading in model.vs
+    vec4 instance = instances[i];
+    float s = sin( instance.z );
+    float c = cos( instance.z );
+    vec3 local = modelSpheres[model].xyz * instance.w;
+    vec3 center = vec3( instance.x + c * local.x + s * local.z, local.y, instance.y + c * local.z - s * local.x );
+    float radius = modelSpheres[model].w * instance.w;
+    for (int p = 0; p < 6; p++)
+    {
+        if (dot( planes[p].xyz, center ) + planes[p].w < -radius)
+            return;
+    }
+    if (hiZ != 0u && isOccluded( center, radius ))
+        return;
+
+    uint slot = atomicAdd( counts[model], 1u );
+    visible[modelFirst[model] + slot] = instance;
+}
+
+//====================================================
@@ -44,11 +44,20 @@ void main()
 #else
 //====================================================
 
+// frame globals, std140 like CameraBlock and LightBlock in main.cpp
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;     // xyz
+};
+
 const int numLights = 10;
-uniform vec3 lightPositions[numLights];
-uniform vec3 lightColors[numLights];
-uniform float lightRadii[numLights];
-uniform vec3 cameraPos;
+layout (std140) uniform Lights
+{
+    vec4 lightPositions[numLights];     // xyz position, w radius
+    vec4 lightColors[numLights];        // rgb
+};
 uniform float shininess;
 uniform float diffuseScale;
 uniform float specularScale;
@@ -68,7 +77,7 @@ void handlePointLight( out vec3 diffuseColor, out vec3 specularColor, vec3 vertP
 
     if(diffuse > 0.0)
     {
-        vec3 viewDir = normalize(cameraPos - vertPos);
+        vec3 viewDir = normalize(cameraPos.xyz - vertPos);
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(halfDir, vertNormal), 0.0);
         specular = pow(specAngle, shininess);
@@ -92,7 +101,7 @@ void main()
     vec3 specularColor = vec3( 0.0 );
     for (int i = 0; i < numLights; i++)
     {
-        handlePointLight( diffuseColor, specularColor, fromVtxPos, wsNormal, lightPositions[i], lightColors[i], lightRadii[i] );
+        handlePointLight( diffuseColor, specularColor, fromVtxPos, wsNormal, lightPositions[i].xyz, lightColors[i].rgb, lightPositions[i].w );
     }
     diffuseColor *= diffuseScale;
     specularColor *= specularScale;
@@ -14,11 +14,66 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+
+// frame globals, std140 like CameraBlock in main.cpp
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;     // xyz
+};
+
+//====================================================
+// Instanced Mode: INSTANCED is defined by the program, one instance per prop
+//====================================================
+#if defined INSTANCED
+//====================================================
+
+layout (location = 5) in vec4 aInstance;    // x, z, heading (radians), scale
+
+//====================================================
+
+vec3 rotateHeading( vec3 v )
+{
+    // heading h turns +z towards +x: columns (c,0,-s), (0,1,0), (s,0,c) with s = sin(h), c = cos(h);
+    // PropSystem::BuildInstances and gpucull.cs place bounds the same way
+    float s = sin( aInstance.z );
+    float c = cos( aInstance.z );
+    return vec3( c * v.x + s * v.z, v.y, c * v.z - s * v.x );
+}
+
+vec3 toWorldPos( vec3 pos )
+{
+    return vec3( aInstance.x, 0.0, aInstance.y ) + rotateHeading( pos * aInstance.w );
+}
+
+vec3 toWorldNormal( vec3 normal )
+{
+    return normalize( rotateHeading( normal ) );
+}
+
+//====================================================
+#else
+//====================================================
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform mat3 itModel;
 
+//====================================================
+
+vec3 toWorldPos( vec3 pos )
+{
+    return (model * vec4( pos, 1.0 )).xyz;
+}
+
+vec3 toWorldNormal( vec3 normal )
+{
+    return normalize( itModel * normal );
+}
+
+//====================================================
+#endif
+
 //====================================================
 // Vertex Lighting Mode
 //====================================================
@@ -26,10 +81,11 @@ uniform mat3 itModel;
 //====================================================
 
 const int numLights = 10;
-uniform vec3 lightPositions[numLights];
-uniform vec3 lightColors[numLights];
-uniform float lightRadii[numLights];
-uniform vec3 cameraPos;
+layout (std140) uniform Lights
+{
+    vec4 lightPositions[numLights];     // xyz position, w radius
+    vec4 lightColors[numLights];        // rgb
+};
 uniform float shininess;
 uniform float diffuseScale;
 uniform float specularScale;
@@ -50,7 +106,7 @@ void handlePointLight( out vec3 diffuseColor, out vec3 specularColor, vec3 vertP
 
     if(diffuse > 0.0)
     {
-        vec3 viewDir = normalize(cameraPos - vertPos);
+        vec3 viewDir = normalize(cameraPos.xyz - vertPos);
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(halfDir, vertNormal), 0.0);
         specular = pow(specAngle, shininess);
@@ -69,14 +125,14 @@ void handlePointLight( out vec3 diffuseColor, out vec3 specularColor, vec3 vertP
 
 void main()
 {
-    vec3 wsPos = (model * vec4( aPos, 1.0 )).xyz;
-    vec3 wsNormal = normalize( itModel * aNormal );
+    vec3 wsPos = toWorldPos( aPos );
+    vec3 wsNormal = toWorldNormal( aNormal );
     fromVtxTexCoords = aTexCoords;
     fromVtxDiffuseColor = vec3( 0.0 );
     fromVtxSpecularColor = vec3( 0.0 );
     for (int i = 0; i < numLights; i++)
     {
-        handlePointLight( fromVtxDiffuseColor, fromVtxSpecularColor, wsPos, wsNormal, lightPositions[i], lightColors[i], lightRadii[i] );
+        handlePointLight( fromVtxDiffuseColor, fromVtxSpecularColor, wsPos, wsNormal, lightPositions[i].xyz, lightColors[i].rgb, lightPositions[i].w );
     }
     fromVtxDiffuseColor *= diffuseScale;
     fromVtxSpecularColor *= specularScale;
@@ -98,8 +154,8 @@ out vec2 fromVtxTexCoords;
 
 void main()
 {
-    fromVtxPos = (model * vec4( aPos, 1.0 )).xyz;
-    fromVtxNormal = normalize( itModel * aNormal );
+    fromVtxPos = toWorldPos( aPos );
+    fromVtxNormal = toWorldNormal( aNormal );
     fromVtxTexCoords = aTexCoords;
     gl_Position = projection * view * vec4( fromVtxPos, 1.0 );
 }
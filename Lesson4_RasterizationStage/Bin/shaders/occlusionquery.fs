@@ -0,0 +1,19 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+// color writes are off while queries draw; only the samples passing the depth test count
+out vec4 fromFragColor;
+
+//====================================================
+
+void main()
+{
+    fromFragColor = vec4( 1.0 );
+}
+
+//====================================================
@@ -0,0 +1,30 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+layout (location = 0) in vec3 aPos;     // corner of the unit cube, see occlusionqueries.h
+
+// frame globals, std140 like CameraBlock in main.cpp
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;     // xyz
+};
+
+// world space box the query stands for
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+//====================================================
+
+void main()
+{
+    gl_Position = projection * view * vec4( mix( boxMin, boxMax, aPos ), 1.0 );
+}
+
+//====================================================
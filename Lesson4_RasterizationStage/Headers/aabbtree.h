@@ -0,0 +1,502 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include <frustum.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+// Dynamic bounding volume hierarchy over axis aligned boxes. Leaves hold a
+// user value and a box fattened by a margin, so an object that moves a
+// little needs no tree update at all. One that leaves its fat box gets a new
+// one and its ancestors are refit on the way up, which is cheap but slowly
+// loosens the tree; Rebuild restores it with a binned SAH top down build.
+// Insert picks its sibling by the same surface area cost.
+//
+// Queries walk the tree with an explicit stack and only open nodes whose box
+// passes, so they cost about log N plus the number of hits. They share one
+// scratch stack: one query at a time, from one thread.
+//=============================================================================
+
+class AabbTree
+{
+public:
+    static int32_t const NULL_NODE = -1;
+
+    explicit AabbTree( float const margin );
+
+    // Returns the leaf, which stays valid until it is removed.
+    int32_t Insert( const glm::vec3& min, const glm::vec3& max, uint32_t const userData );
+    void Remove( int32_t const leaf );
+    // False if the box still fits the leaf's fat box, and nothing changed.
+    bool Move( int32_t const leaf, const glm::vec3& min, const glm::vec3& max );
+    void Rebuild();
+
+    uint32_t GetUserData( int32_t const leaf ) const { return mNodes[leaf].mUserData; }
+    void SetUserData( int32_t const leaf, uint32_t const userData ) { mNodes[leaf].mUserData = userData; }
+    uint32_t GetLeafCount() const { return mLeafCount; }
+    int32_t GetHeight() const { return mRoot != NULL_NODE ? mNodes[mRoot].mHeight : 0; }
+
+    // fn( userData, inside ) for every leaf box in the frustum; inside is false
+    // when the box only crosses a plane and the object needs a closer look.
+    template<typename Fn>
+    void QueryFrustum( const Frustum& frustum, const Fn& fn ) const;
+    // fn( userData ) for every leaf box touching the sphere.
+    template<typename Fn>
+    void QuerySphere( const glm::vec3& center, float const radius, const Fn& fn ) const;
+    // fn( userData, maxDist ) for every leaf box the ray enters within maxDist,
+    // in no particular order. fn returns the new maxDist: its own hit distance
+    // to look for the closest hit, or maxDist unchanged to find them all.
+    template<typename Fn>
+    void QueryRay( const glm::vec3& origin, const glm::vec3& direction, float maxDist, const Fn& fn ) const;
+
+private:
+    static uint32_t const SAH_BINS = 16;
+
+    struct Node
+    {
+        bool IsLeaf() const { return mChild[0] == NULL_NODE; }
+
+        glm::vec3 mMin;
+        glm::vec3 mMax;
+        int32_t mParent;        // next free node while on the free list
+        int32_t mChild[2];
+        int32_t mHeight;        // 0 for a leaf, -1 while free
+        uint32_t mUserData;
+    };
+
+    static float Area( const glm::vec3& min, const glm::vec3& max )
+    {
+        glm::vec3 const size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    int32_t AllocateNode();
+    void FreeNode( int32_t const node );
+    void InsertLeaf( int32_t const leaf );
+    void RemoveLeaf( int32_t const leaf );
+    void Refit( int32_t node );
+    int32_t Build( int32_t* leaves, uint32_t const count );
+
+    std::vector<Node> mNodes;
+    int32_t mRoot;
+    int32_t mFreeList;
+    uint32_t mLeafCount;
+    float mMargin;
+    std::vector<int32_t> mLeaves;           // Rebuild scratch
+    mutable std::vector<int32_t> mStack;    // query scratch; ~node marks a subtree known to be inside
+};
+
+//=============================================================================
+
+inline AabbTree::AabbTree( float const margin ):
+    mRoot( NULL_NODE ),
+    mFreeList( NULL_NODE ),
+    mLeafCount( 0 ),
+    mMargin( margin )
+{
+}
+
+//=============================================================================
+
+inline int32_t AabbTree::AllocateNode()
+{
+    int32_t node = mFreeList;
+    if (node == NULL_NODE)
+    {
+        node = (int32_t)mNodes.size();
+        mNodes.push_back( Node() );
+    }
+    else
+    {
+        mFreeList = mNodes[node].mParent;
+    }
+    Node& allocated = mNodes[node];
+    allocated.mParent = NULL_NODE;
+    allocated.mChild[0] = NULL_NODE;
+    allocated.mChild[1] = NULL_NODE;
+    allocated.mHeight = 0;
+    allocated.mUserData = 0;
+    return node;
+}
+
+//=============================================================================
+
+inline void AabbTree::FreeNode( int32_t const node )
+{
+    mNodes[node].mParent = mFreeList;
+    mNodes[node].mHeight = -1;
+    mFreeList = node;
+}
+
+//=============================================================================
+
+inline int32_t AabbTree::Insert( const glm::vec3& min, const glm::vec3& max, uint32_t const userData )
+{
+    int32_t const leaf = AllocateNode();
+    mNodes[leaf].mMin = min - mMargin;
+    mNodes[leaf].mMax = max + mMargin;
+    mNodes[leaf].mUserData = userData;
+    InsertLeaf( leaf );
+    mLeafCount++;
+    return leaf;
+}
+
+//=============================================================================
+
+inline void AabbTree::Remove( int32_t const leaf )
+{
+    RemoveLeaf( leaf );
+    FreeNode( leaf );
+    mLeafCount--;
+}
+
+//=============================================================================
+
+inline bool AabbTree::Move( int32_t const leaf, const glm::vec3& min, const glm::vec3& max )
+{
+    Node& node = mNodes[leaf];
+    if (glm::all( glm::greaterThanEqual( min, node.mMin ) ) && glm::all( glm::lessThanEqual( max, node.mMax ) ))
+        return false;
+
+    // Refit the ancestors, up to the first one the new box doesn't change.
+    node.mMin = min - mMargin;
+    node.mMax = max + mMargin;
+    for (int32_t parent = node.mParent; parent != NULL_NODE; parent = mNodes[parent].mParent)
+    {
+        Node& refit = mNodes[parent];
+        glm::vec3 const newMin = glm::min( mNodes[refit.mChild[0]].mMin, mNodes[refit.mChild[1]].mMin );
+        glm::vec3 const newMax = glm::max( mNodes[refit.mChild[0]].mMax, mNodes[refit.mChild[1]].mMax );
+        if (newMin == refit.mMin && newMax == refit.mMax)
+            break;
+        refit.mMin = newMin;
+        refit.mMax = newMax;
+    }
+    return true;
+}
+
+//=============================================================================
+
+inline void AabbTree::InsertLeaf( int32_t const leaf )
+{
+    if (mRoot == NULL_NODE)
+    {
+        mRoot = leaf;
+        mNodes[leaf].mParent = NULL_NODE;
+        return;
+    }
+
+    // Walk down towards the sibling that grows the total surface area least:
+    // pairing here costs the combined box, going on costs the growth of this
+    // node (inherited by everything below it) plus the growth of the child.
+    glm::vec3 const leafMin = mNodes[leaf].mMin;
+    glm::vec3 const leafMax = mNodes[leaf].mMax;
+    int32_t sibling = mRoot;
+    while (!mNodes[sibling].IsLeaf())
+    {
+        const Node& node = mNodes[sibling];
+        float const area = Area( node.mMin, node.mMax );
+        float const combinedArea = Area( glm::min( node.mMin, leafMin ), glm::max( node.mMax, leafMax ) );
+        float const cost = 2.0f * combinedArea;
+        float const inheritedCost = 2.0f * (combinedArea - area);
+
+        float childCost[2];
+        for (uint32_t c = 0; c < 2; c++)
+        {
+            const Node& child = mNodes[node.mChild[c]];
+            float const grownArea = Area( glm::min( child.mMin, leafMin ), glm::max( child.mMax, leafMax ) );
+            childCost[c] = (child.IsLeaf() ? grownArea : grownArea - Area( child.mMin, child.mMax )) + inheritedCost;
+        }
+        if (cost < childCost[0] && cost < childCost[1])
+            break;
+        sibling = childCost[0] < childCost[1] ? node.mChild[0] : node.mChild[1];
+    }
+
+    // A new parent takes the sibling's place and holds both.
+    int32_t const oldParent = mNodes[sibling].mParent;
+    int32_t const parent = AllocateNode();
+    Node& node = mNodes[parent];
+    node.mParent = oldParent;
+    node.mChild[0] = sibling;
+    node.mChild[1] = leaf;
+    mNodes[sibling].mParent = parent;
+    mNodes[leaf].mParent = parent;
+    if (oldParent == NULL_NODE)
+    {
+        mRoot = parent;
+    }
+    else
+    {
+        Node& old = mNodes[oldParent];
+        old.mChild[old.mChild[0] == sibling ? 0 : 1] = parent;
+    }
+    Refit( parent );
+}
+
+//=============================================================================
+
+inline void AabbTree::RemoveLeaf( int32_t const leaf )
+{
+    if (leaf == mRoot)
+    {
+        mRoot = NULL_NODE;
+        return;
+    }
+
+    // The sibling takes the parent's place and the parent goes.
+    int32_t const parent = mNodes[leaf].mParent;
+    int32_t const grandParent = mNodes[parent].mParent;
+    int32_t const sibling = mNodes[parent].mChild[mNodes[parent].mChild[0] == leaf ? 1 : 0];
+    mNodes[sibling].mParent = grandParent;
+    if (grandParent == NULL_NODE)
+    {
+        mRoot = sibling;
+    }
+    else
+    {
+        Node& grand = mNodes[grandParent];
+        grand.mChild[grand.mChild[0] == parent ? 0 : 1] = sibling;
+        Refit( grandParent );
+    }
+    FreeNode( parent );
+}
+
+//=============================================================================
+
+inline void AabbTree::Refit( int32_t node )
+{
+    for (; node != NULL_NODE; node = mNodes[node].mParent)
+    {
+        Node& refit = mNodes[node];
+        const Node& child0 = mNodes[refit.mChild[0]];
+        const Node& child1 = mNodes[refit.mChild[1]];
+        refit.mMin = glm::min( child0.mMin, child1.mMin );
+        refit.mMax = glm::max( child0.mMax, child1.mMax );
+        refit.mHeight = 1 + std::max( child0.mHeight, child1.mHeight );
+    }
+}
+
+//=============================================================================
+
+inline void AabbTree::Rebuild()
+{
+    // Keep the leaves, and with them the handles given out; only the inner nodes are redone.
+    if (mRoot == NULL_NODE)
+        return;
+    mLeaves.clear();
+    for (int32_t i = 0; i < (int32_t)mNodes.size(); i++)
+    {
+        if (mNodes[i].mHeight < 0)
+            continue;
+        if (mNodes[i].IsLeaf())
+        {
+            mLeaves.push_back( i );
+        }
+        else
+        {
+            FreeNode( i );
+        }
+    }
+    mRoot = Build( mLeaves.data(), (uint32_t)mLeaves.size() );
+    mNodes[mRoot].mParent = NULL_NODE;
+}
+
+//=============================================================================
+
+inline int32_t AabbTree::Build( int32_t* leaves, uint32_t const count )
+{
+    if (count == 1)
+        return leaves[0];
+
+    // Split along the longest axis of the box centers.
+    glm::vec3 centerMin( FLT_MAX );
+    glm::vec3 centerMax( -FLT_MAX );
+    for (uint32_t i = 0; i < count; i++)
+    {
+        glm::vec3 const center = (mNodes[leaves[i]].mMin + mNodes[leaves[i]].mMax) * 0.5f;
+        centerMin = glm::min( centerMin, center );
+        centerMax = glm::max( centerMax, center );
+    }
+    glm::vec3 const extent = centerMax - centerMin;
+    uint32_t const axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    auto const centerOf = [this, axis]( int32_t const leaf ) { return mNodes[leaf].mMin[axis] + mNodes[leaf].mMax[axis]; };
+
+    uint32_t split = 0;
+    if (extent[axis] > 0.0f)
+    {
+        // Binned SAH: drop the centers into equal bins, then price every split
+        // between bins as area times count on each side.
+        struct Bin
+        {
+            glm::vec3 mMin;
+            glm::vec3 mMax;
+            uint32_t mCount;
+        };
+        Bin bins[SAH_BINS];
+        for (Bin& bin : bins)
+        {
+            bin = Bin{ glm::vec3( FLT_MAX ), glm::vec3( -FLT_MAX ), 0 };
+        }
+        float const binScale = (float)SAH_BINS / (2.0f * extent[axis]);
+        float const binBase = 2.0f * centerMin[axis];
+        auto const binOf = [&]( int32_t const leaf ) { return std::min( (uint32_t)std::max( (centerOf( leaf ) - binBase) * binScale, 0.0f ), SAH_BINS - 1 ); };
+        for (uint32_t i = 0; i < count; i++)
+        {
+            Bin& bin = bins[binOf( leaves[i] )];
+            bin.mMin = glm::min( bin.mMin, mNodes[leaves[i]].mMin );
+            bin.mMax = glm::max( bin.mMax, mNodes[leaves[i]].mMax );
+            bin.mCount++;
+        }
+
+        float leftCost[SAH_BINS];
+        glm::vec3 boxMin( FLT_MAX );
+        glm::vec3 boxMax( -FLT_MAX );
+        uint32_t leftCount = 0;
+        for (uint32_t b = 0; b + 1 < SAH_BINS; b++)
+        {
+            boxMin = glm::min( boxMin, bins[b].mMin );
+            boxMax = glm::max( boxMax, bins[b].mMax );
+            leftCount += bins[b].mCount;
+            leftCost[b] = leftCount > 0 ? Area( boxMin, boxMax ) * (float)leftCount : 0.0f;
+        }
+        boxMin = glm::vec3( FLT_MAX );
+        boxMax = glm::vec3( -FLT_MAX );
+        uint32_t rightCount = 0;
+        float bestCost = FLT_MAX;
+        uint32_t bestBin = 0;
+        for (uint32_t b = SAH_BINS - 1; b > 0; b--)
+        {
+            boxMin = glm::min( boxMin, bins[b].mMin );
+            boxMax = glm::max( boxMax, bins[b].mMax );
+            rightCount += bins[b].mCount;
+            float const cost = leftCost[b - 1] + (rightCount > 0 ? Area( boxMin, boxMax ) * (float)rightCount : 0.0f);
+            if (rightCount > 0 && rightCount < count && cost < bestCost)
+            {
+                bestCost = cost;
+                bestBin = b - 1;
+            }
+        }
+        split = (uint32_t)(std::partition( leaves, leaves + count, [&]( int32_t const leaf ) { return binOf( leaf ) <= bestBin; } ) - leaves);
+    }
+    if (split == 0 || split == count)
+    {
+        // All centers in one spot, or the bins couldn't separate them: halve by position.
+        split = count / 2;
+        std::nth_element( leaves, leaves + split, leaves + count, [&]( int32_t const a, int32_t const b ) { return centerOf( a ) < centerOf( b ); } );
+    }
+
+    int32_t const child0 = Build( leaves, split );
+    int32_t const child1 = Build( leaves + split, count - split );
+    int32_t const node = AllocateNode();
+    Node& built = mNodes[node];
+    built.mChild[0] = child0;
+    built.mChild[1] = child1;
+    built.mMin = glm::min( mNodes[child0].mMin, mNodes[child1].mMin );
+    built.mMax = glm::max( mNodes[child0].mMax, mNodes[child1].mMax );
+    built.mHeight = 1 + std::max( mNodes[child0].mHeight, mNodes[child1].mHeight );
+    mNodes[child0].mParent = node;
+    mNodes[child1].mParent = node;
+    return node;
+}
+
+//=============================================================================
+
+template<typename Fn>
+void AabbTree::QueryFrustum( const Frustum& frustum, const Fn& fn ) const
+{
+    // Below a node that is inside as a whole nothing needs testing any more.
+    if (mRoot == NULL_NODE)
+        return;
+    mStack.clear();
+    mStack.push_back( mRoot );
+    while (!mStack.empty())
+    {
+        int32_t const entry = mStack.back();
+        mStack.pop_back();
+        bool inside = entry < 0;
+        const Node& node = mNodes[inside ? ~entry : entry];
+        if (!inside)
+        {
+            Frustum::Containment const containment = frustum.ClassifyBox( node.mMin, node.mMax );
+            if (containment == Frustum::OUTSIDE)
+                continue;
+            inside = containment == Frustum::INSIDE;
+        }
+        if (node.IsLeaf())
+        {
+            fn( node.mUserData, inside );
+            continue;
+        }
+        mStack.push_back( inside ? ~node.mChild[0] : node.mChild[0] );
+        mStack.push_back( inside ? ~node.mChild[1] : node.mChild[1] );
+    }
+}
+
+//=============================================================================
+
+template<typename Fn>
+void AabbTree::QuerySphere( const glm::vec3& center, float const radius, const Fn& fn ) const
+{
+    if (mRoot == NULL_NODE)
+        return;
+    float const radiusSq = radius * radius;
+    mStack.clear();
+    mStack.push_back( mRoot );
+    while (!mStack.empty())
+    {
+        const Node& node = mNodes[mStack.back()];
+        mStack.pop_back();
+        glm::vec3 const offset = glm::clamp( center, node.mMin, node.mMax ) - center;
+        if (glm::dot( offset, offset ) > radiusSq)
+            continue;
+        if (node.IsLeaf())
+        {
+            fn( node.mUserData );
+            continue;
+        }
+        mStack.push_back( node.mChild[0] );
+        mStack.push_back( node.mChild[1] );
+    }
+}
+
+//=============================================================================
+
+template<typename Fn>
+void AabbTree::QueryRay( const glm::vec3& origin, const glm::vec3& direction, float maxDist, const Fn& fn ) const
+{
+    // Slab test; a zero direction component gives infinities, which the min and max sort out.
+    if (mRoot == NULL_NODE)
+        return;
+    glm::vec3 const invDirection = 1.0f / direction;
+    mStack.clear();
+    mStack.push_back( mRoot );
+    while (!mStack.empty())
+    {
+        const Node& node = mNodes[mStack.back()];
+        mStack.pop_back();
+        glm::vec3 const t0 = (node.mMin - origin) * invDirection;
+        glm::vec3 const t1 = (node.mMax - origin) * invDirection;
+        glm::vec3 const tMin = glm::min( t0, t1 );
+        glm::vec3 const tMax = glm::max( t0, t1 );
+        float const enter = std::max( std::max( tMin.x, tMin.y ), std::max( tMin.z, 0.0f ) );
+        float const leave = std::min( std::min( tMax.x, tMax.y ), tMax.z );
+        if (enter > leave || enter > maxDist)
+            continue;
+        if (node.IsLeaf())
+        {
+            maxDist = fn( node.mUserData, maxDist );
+            continue;
+        }
+        mStack.push_back( node.mChild[0] );
+        mStack.push_back( node.mChild[1] );
+    }
+}
+
+//=============================================================================
+
+#endif
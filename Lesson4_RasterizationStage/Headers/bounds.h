@@ -0,0 +1,93 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+//=============================================================================
+// Bounding volumes of a set of points: an axis aligned box, and a sphere
+// around the box center that holds every point. The sphere is what the
+// SIMD culling tests; the box is tighter for flat or long shapes.
+//=============================================================================
+
+struct Bounds
+{
+    // stride is the byte distance between points, e.g. sizeof( Vertex ).
+    static Bounds FromPoints( const glm::vec3* points, size_t const count, size_t const stride );
+    // Smallest box and a sphere around its center that hold both a and b.
+    static Bounds Merge( const Bounds& a, const Bounds& b );
+
+    // Bounds after an affine transform; the sphere grows by the largest axis scale.
+    Bounds Transformed( const glm::mat4& matrix ) const;
+
+    glm::vec3 mMin;
+    glm::vec3 mMax;
+    glm::vec3 mCenter;
+    float mRadius;
+};
+
+//=============================================================================
+
+inline Bounds Bounds::FromPoints( const glm::vec3* points, size_t const count, size_t const stride )
+{
+    Bounds bounds = { glm::vec3( 0.0f ), glm::vec3( 0.0f ), glm::vec3( 0.0f ), 0.0f };
+    if (count == 0)
+        return bounds;
+
+    const uint8_t* const base = reinterpret_cast<const uint8_t*>( points );
+    bounds.mMin = bounds.mMax = *points;
+    for (size_t i = 1; i < count; i++)
+    {
+        const glm::vec3& point = *reinterpret_cast<const glm::vec3*>( base + i * stride );
+        bounds.mMin = glm::min( bounds.mMin, point );
+        bounds.mMax = glm::max( bounds.mMax, point );
+    }
+
+    // Centered on the box, but only as big as the farthest point needs.
+    bounds.mCenter = (bounds.mMin + bounds.mMax) * 0.5f;
+    float radiusSq = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 const offset = *reinterpret_cast<const glm::vec3*>( base + i * stride ) - bounds.mCenter;
+        radiusSq = glm::max( radiusSq, glm::dot( offset, offset ) );
+    }
+    bounds.mRadius = glm::sqrt( radiusSq );
+    return bounds;
+}
+
+//=============================================================================
+
+inline Bounds Bounds::Merge( const Bounds& a, const Bounds& b )
+{
+    Bounds bounds;
+    bounds.mMin = glm::min( a.mMin, b.mMin );
+    bounds.mMax = glm::max( a.mMax, b.mMax );
+    bounds.mCenter = (bounds.mMin + bounds.mMax) * 0.5f;
+    bounds.mRadius = glm::max( glm::length( a.mCenter - bounds.mCenter ) + a.mRadius, glm::length( b.mCenter - bounds.mCenter ) + b.mRadius );
+    return bounds;
+}
+
+//=============================================================================
+
+inline Bounds Bounds::Transformed( const glm::mat4& matrix ) const
+{
+    // The box's new half extents are its old ones through the absolute matrix (Arvo).
+    glm::mat3 const linear( matrix );
+    glm::mat3 const absolute( glm::abs( linear[0] ), glm::abs( linear[1] ), glm::abs( linear[2] ) );
+    glm::vec3 const boxCenter = glm::vec3( matrix * glm::vec4( (mMin + mMax) * 0.5f, 1.0f ) );
+    glm::vec3 const halfExtent = absolute * ((mMax - mMin) * 0.5f);
+    float const scale = glm::max( glm::length( linear[0] ), glm::max( glm::length( linear[1] ), glm::length( linear[2] ) ) );
+
+    Bounds bounds;
+    bounds.mMin = boxCenter - halfExtent;
+    bounds.mMax = boxCenter + halfExtent;
+    bounds.mCenter = glm::vec3( matrix * glm::vec4( mCenter, 1.0f ) );
+    bounds.mRadius = mRadius * scale;
+    return bounds;
+}
+
+//=============================================================================
+
+#endif
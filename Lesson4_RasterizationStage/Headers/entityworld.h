@@ -0,0 +1,206 @@
+#ifndef ENTITY_WORLD_H
+#define ENTITY_WORLD_H
+
+#include <objectpool.h>
+
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+//=============================================================================
+// Sparse set entity component store. An entity is a generational handle with
+// no data of its own; every component type has its own store where the
+// components are packed in a dense array, plus a sparse array mapping entity
+// index to dense index. Iterating a component type is a linear walk over
+// the dense array, and a lookup by entity is two array reads.
+//=============================================================================
+
+struct EntityRecord
+{
+};
+
+typedef ObjectPool<EntityRecord>::Handle Entity;
+
+//=============================================================================
+
+template<typename T>
+class ComponentStore
+{
+public:
+    // Adds the component, or overwrites it if the entity already has one.
+    T& Add( Entity const entity, const T& component );
+    void Remove( Entity const entity );
+
+    // nullptr if the entity has no such component.
+    T* Get( Entity const entity );
+    const T* Get( Entity const entity ) const;
+
+    uint32_t GetCount() const { return (uint32_t)mDense.size(); }
+    T* GetData() { return mDense.data(); }
+    const Entity* GetEntities() const { return mEntities.data(); }
+
+private:
+    static uint32_t const INVALID_INDEX = ~0u;
+
+    uint32_t Find( Entity const entity ) const;
+
+    std::vector<uint32_t> mSparse;      // entity index -> dense index
+    std::vector<T> mDense;
+    std::vector<Entity> mEntities;      // owner of each dense component
+};
+
+//=============================================================================
+
+template<typename T>
+uint32_t const ComponentStore<T>::INVALID_INDEX;
+
+//=============================================================================
+
+template<typename T>
+uint32_t ComponentStore<T>::Find( Entity const entity ) const
+{
+    // The generation check rejects stale handles whose slot has been reused.
+    uint32_t const index = entity.GetIndex();
+    if (index >= mSparse.size())
+        return INVALID_INDEX;
+    uint32_t const dense = mSparse[index];
+    return (dense != INVALID_INDEX && mEntities[dense] == entity) ? dense : INVALID_INDEX;
+}
+
+//=============================================================================
+
+template<typename T>
+T& ComponentStore<T>::Add( Entity const entity, const T& component )
+{
+    uint32_t const existing = Find( entity );
+    if (existing != INVALID_INDEX)
+    {
+        mDense[existing] = component;
+        return mDense[existing];
+    }
+
+    uint32_t const index = entity.GetIndex();
+    if (index >= mSparse.size())
+    {
+        mSparse.resize( index + 1, INVALID_INDEX );
+    }
+    mSparse[index] = (uint32_t)mDense.size();
+    mDense.push_back( component );
+    mEntities.push_back( entity );
+    return mDense.back();
+}
+
+//=============================================================================
+
+template<typename T>
+void ComponentStore<T>::Remove( Entity const entity )
+{
+    uint32_t const dense = Find( entity );
+    if (dense == INVALID_INDEX)
+        return;
+
+    // Swap the last component into the hole to keep the array packed.
+    uint32_t const last = (uint32_t)mDense.size() - 1;
+    if (dense != last)
+    {
+        mDense[dense] = mDense[last];
+        mEntities[dense] = mEntities[last];
+        mSparse[mEntities[dense].GetIndex()] = dense;
+    }
+    mDense.pop_back();
+    mEntities.pop_back();
+    mSparse[entity.GetIndex()] = INVALID_INDEX;
+}
+
+//=============================================================================
+
+template<typename T>
+T* ComponentStore<T>::Get( Entity const entity )
+{
+    uint32_t const dense = Find( entity );
+    return dense != INVALID_INDEX ? &mDense[dense] : nullptr;
+}
+
+//=============================================================================
+
+template<typename T>
+const T* ComponentStore<T>::Get( Entity const entity ) const
+{
+    uint32_t const dense = Find( entity );
+    return dense != INVALID_INDEX ? &mDense[dense] : nullptr;
+}
+
+//=============================================================================
+// The world owns the entities and one store per component type listed.
+//=============================================================================
+
+template<typename... Components>
+class EntityWorld
+{
+public:
+    Entity Create() { return mEntities.Create(); }
+    void Destroy( Entity const entity );
+    bool IsAlive( Entity const entity ) const { return mEntities.IsValid( entity ); }
+
+    template<typename T>
+    T& Add( Entity const entity, const T& component = T() ) { return GetStore<T>().Add( entity, component ); }
+    template<typename T>
+    void Remove( Entity const entity ) { GetStore<T>().Remove( entity ); }
+    template<typename T>
+    T* Get( Entity const entity ) { return GetStore<T>().Get( entity ); }
+
+    template<typename T>
+    ComponentStore<T>& GetStore() { return std::get<ComponentStore<T>>( mStores ); }
+
+    // Calls fn( entity, first, rest... ) for every entity that has all the
+    // listed components. Walks First's dense array, so list the rarest
+    // component first. fn must not add or remove components.
+    template<typename First, typename... Rest, typename Fn>
+    void Each( Fn fn );
+
+private:
+    static bool AllValid() { return true; }
+    template<typename P, typename... Ps>
+    static bool AllValid( const P* ptr, const Ps*... ptrs ) { return ptr != nullptr && AllValid( ptrs... ); }
+
+    ObjectPool<EntityRecord> mEntities;
+    std::tuple<ComponentStore<Components>...> mStores;
+};
+
+//=============================================================================
+
+template<typename... Components>
+void EntityWorld<Components...>::Destroy( Entity const entity )
+{
+    if (!IsAlive( entity ))
+        return;
+
+    int const removed[] = { 0, (GetStore<Components>().Remove( entity ), 0)... };
+    (void)removed;
+    mEntities.Destroy( entity );
+}
+
+//=============================================================================
+
+template<typename... Components>
+template<typename First, typename... Rest, typename Fn>
+void EntityWorld<Components...>::Each( Fn fn )
+{
+    ComponentStore<First>& store = GetStore<First>();
+    First* const data = store.GetData();
+    const Entity* const entities = store.GetEntities();
+    uint32_t const count = store.GetCount();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::tuple<Rest*...> const rest( GetStore<Rest>().Get( entities[i] )... );
+        (void)rest;
+        if (AllValid( std::get<Rest*>( rest )... ))
+        {
+            fn( entities[i], data[i], *std::get<Rest*>( rest )... );
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cassert>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+//=============================================================================
+// Bump allocator for data that only lives until the end of the frame. Alloc
+// is a pointer increment; Reset at the end of the frame frees everything at
+// once and no destructors run, so only put trivially destructible data here.
+//
+// When a frame runs past the block, overflow blocks come from the heap. The
+// next Reset folds them into one bigger block, so after a frame or two at
+// peak usage the arena stops touching the heap.
+//
+// Not thread safe: the main thread owns GetFrameArena().
+//=============================================================================
+
+class FrameArena
+{
+public:
+    explicit FrameArena( size_t const capacity );
+    FrameArena( const FrameArena& ) = delete;
+    FrameArena& operator=( const FrameArena& ) = delete;
+
+    void* Alloc( size_t const size, size_t const align = alignof( std::max_align_t ) );
+
+    // Uninitialized storage for count T's.
+    template<typename T>
+    T* AllocArray( size_t const count ) { return static_cast<T*>( Alloc( sizeof( T ) * count, alignof( T ) ) ); }
+
+    // printf into the arena; the string is valid until Reset.
+    const char* Format( const char* format, ... );
+
+    void Reset();
+
+    size_t GetCapacity() const { return mCapacity; }
+    size_t GetUsed() const { return mUsed + mOverflowUsed; }
+    size_t GetPeak() const { return mPeak; }
+
+private:
+    std::unique_ptr<uint8_t[]> mBlock;
+    size_t mCapacity;
+    size_t mUsed;
+    std::vector<std::unique_ptr<uint8_t[]>> mOverflow;
+    size_t mOverflowUsed;   // bytes handed out from overflow blocks
+    size_t mPeak;           // most bytes used by any frame
+};
+
+//=============================================================================
+
+inline FrameArena::FrameArena( size_t const capacity ):
+    mBlock( new uint8_t[capacity] ),
+    mCapacity( capacity ),
+    mUsed( 0 ),
+    mOverflowUsed( 0 ),
+    mPeak( 0 )
+{
+}
+
+//=============================================================================
+
+inline void* FrameArena::Alloc( size_t const size, size_t const align )
+{
+    assert( align != 0 && (align & (align - 1)) == 0 );
+    uintptr_t const base = (uintptr_t)mBlock.get();
+    uintptr_t const start = (base + mUsed + align - 1) & ~(uintptr_t)(align - 1);
+    if (start + size <= base + mCapacity)
+    {
+        mUsed = (size_t)(start + size - base);
+        return (void*)start;
+    }
+
+    // Out of room: give this allocation its own heap block for the rest of
+    // the frame and remember the size so Reset can grow the main block.
+    mOverflow.push_back( std::unique_ptr<uint8_t[]>( new uint8_t[size + align] ) );
+    mOverflowUsed += size + align;
+    uintptr_t const overflow = (uintptr_t)mOverflow.back().get();
+    return (void*)((overflow + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+//=============================================================================
+
+inline const char* FrameArena::Format( const char* format, ... )
+{
+    va_list args;
+    va_start( args, format );
+    va_list argsCopy;
+    va_copy( argsCopy, args );
+    int const length = vsnprintf( nullptr, 0, format, args );
+    va_end( args );
+
+    char* const str = AllocArray<char>( (size_t)(length > 0 ? length : 0) + 1 );
+    vsnprintf( str, (size_t)(length > 0 ? length : 0) + 1, format, argsCopy );
+    va_end( argsCopy );
+    return str;
+}
+
+//=============================================================================
+
+inline void FrameArena::Reset()
+{
+    size_t const used = GetUsed();
+    mPeak = used > mPeak ? used : mPeak;
+    if (!mOverflow.empty())
+    {
+        mOverflow.clear();
+        mCapacity = mPeak + mPeak / 2;
+        mBlock.reset( new uint8_t[mCapacity] );
+    }
+    mUsed = 0;
+    mOverflowUsed = 0;
+}
+
+//=============================================================================
+
+inline FrameArena& GetFrameArena()
+{
+    static FrameArena arena( 256 * 1024 );
+    return arena;
+}
+
+//=============================================================================
+
+#endif
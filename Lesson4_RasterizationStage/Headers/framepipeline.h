@@ -0,0 +1,116 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+//=============================================================================
+// Fixed ring of COUNT frame slots between one producer thread and one
+// consumer thread. The producer fills a slot between BeginWrite and EndWrite
+// while the consumer works on an earlier one between BeginRead and EndRead;
+// a slot is never touched by both at once. With the default of two slots the
+// producer runs at most one frame ahead, and blocks in BeginWrite until the
+// consumer lets go of the frame before.
+//
+// Slots are reused, not rebuilt, so their containers keep their capacity.
+// The lock hand off also orders memory: whatever the consumer writes into a
+// slot before EndRead is visible to the producer after its next BeginWrite
+// of that slot.
+//=============================================================================
+
+template<typename T, uint32_t COUNT = 2>
+class FramePipeline
+{
+public:
+    static uint32_t const SLOT_COUNT = COUNT;
+
+    FramePipeline(): mWritten( 0 ), mRead( 0 ), mQuit( false ) {}
+    FramePipeline( const FramePipeline& ) = delete;
+    FramePipeline& operator=( const FramePipeline& ) = delete;
+
+    // Direct slot access, only for setup before the consumer starts.
+    T& GetSlot( uint32_t const index ) { return mSlots[index]; }
+
+    // Wait for a free slot, or for a published one; nullptr once Quit is called.
+    T* BeginWrite();
+    void EndWrite();
+    T* BeginRead();
+    void EndRead();
+
+    // Wakes both sides up for good; frames not yet read are dropped.
+    void Quit();
+
+private:
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    T mSlots[COUNT];
+    uint64_t mWritten;      // slots published so far
+    uint64_t mRead;         // slots released by the consumer so far
+    bool mQuit;
+};
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+uint32_t const FramePipeline<T, COUNT>::SLOT_COUNT;
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+T* FramePipeline<T, COUNT>::BeginWrite()
+{
+    std::unique_lock<std::mutex> lock( mLock );
+    mChanged.wait( lock, [this]() { return mQuit || mWritten - mRead < COUNT; } );
+    return mQuit ? nullptr : &mSlots[mWritten % COUNT];
+}
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+void FramePipeline<T, COUNT>::EndWrite()
+{
+    {
+        std::lock_guard<std::mutex> lock( mLock );
+        mWritten++;
+    }
+    mChanged.notify_all();
+}
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+T* FramePipeline<T, COUNT>::BeginRead()
+{
+    std::unique_lock<std::mutex> lock( mLock );
+    mChanged.wait( lock, [this]() { return mQuit || mRead < mWritten; } );
+    return mQuit ? nullptr : &mSlots[mRead % COUNT];
+}
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+void FramePipeline<T, COUNT>::EndRead()
+{
+    {
+        std::lock_guard<std::mutex> lock( mLock );
+        mRead++;
+    }
+    mChanged.notify_all();
+}
+
+//=============================================================================
+
+template<typename T, uint32_t COUNT>
+void FramePipeline<T, COUNT>::Quit()
+{
+    {
+        std::lock_guard<std::mutex> lock( mLock );
+        mQuit = true;
+    }
+    mChanged.notify_all();
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+//=============================================================================
+// Six clip planes pulled out of a view projection matrix (Gribb/Hartmann).
+// Planes face inwards and are normalized, so plane distances are in meters.
+//
+// CullSpheres tests spheres given as separate x, y, z and radius streams,
+// eight at a time with AVX and four with SSE: each plane is one multiply
+// add chain and one compare across all lanes.
+//=============================================================================
+
+struct Frustum
+{
+    enum Containment
+    {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE,
+    };
+
+    Frustum() = default;
+    explicit Frustum( const glm::mat4& viewProjection );
+
+    bool IntersectsSphere( const glm::vec3& center, float const radius ) const;
+    bool IntersectsBox( const glm::vec3& min, const glm::vec3& max ) const;
+    Containment ClassifyBox( const glm::vec3& min, const glm::vec3& max ) const;
+    // Sets visible[i] to 1 for every sphere touching the frustum, else 0; returns how many are visible.
+    uint32_t CullSpheres( const float* x, const float* y, const float* z, const float* radius, uint32_t const count, uint8_t* visible ) const;
+
+    glm::vec4 mPlanes[6];   // left, right, bottom, top, near, far
+};
+
+//=============================================================================
+
+inline Frustum::Frustum( const glm::mat4& viewProjection )
+{
+    // glm is column major, so row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r]).
+    glm::mat4 const m = glm::transpose( viewProjection );
+    mPlanes[0] = m[3] + m[0];
+    mPlanes[1] = m[3] - m[0];
+    mPlanes[2] = m[3] + m[1];
+    mPlanes[3] = m[3] - m[1];
+    mPlanes[4] = m[3] + m[2];
+    mPlanes[5] = m[3] - m[2];
+    for (glm::vec4& plane : mPlanes)
+    {
+        plane /= glm::length( glm::vec3( plane ) );
+    }
+}
+
+//=============================================================================
+
+inline bool Frustum::IntersectsSphere( const glm::vec3& center, float const radius ) const
+{
+    for (const glm::vec4& plane : mPlanes)
+    {
+        if (glm::dot( glm::vec3( plane ), center ) + plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+//=============================================================================
+
+inline bool Frustum::IntersectsBox( const glm::vec3& min, const glm::vec3& max ) const
+{
+    // Only the corner farthest along the plane normal needs to be inside.
+    for (const glm::vec4& plane : mPlanes)
+    {
+        glm::vec3 const corner( plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z );
+        if (glm::dot( glm::vec3( plane ), corner ) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+//=============================================================================
+
+inline Frustum::Containment Frustum::ClassifyBox( const glm::vec3& min, const glm::vec3& max ) const
+{
+    // Out if the corner farthest along a normal is behind its plane; in if even the nearest corner is in front of all six.
+    Containment result = INSIDE;
+    for (const glm::vec4& plane : mPlanes)
+    {
+        glm::vec3 const normal( plane );
+        glm::vec3 const farCorner( plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z );
+        glm::vec3 const nearCorner( plane.x >= 0.0f ? min.x : max.x, plane.y >= 0.0f ? min.y : max.y, plane.z >= 0.0f ? min.z : max.z );
+        if (glm::dot( normal, farCorner ) + plane.w < 0.0f)
+            return OUTSIDE;
+        if (glm::dot( normal, nearCorner ) + plane.w < 0.0f)
+        {
+            result = INTERSECTS;
+        }
+    }
+    return result;
+}
+
+//=============================================================================
+
+inline uint32_t Frustum::CullSpheres( const float* x, const float* y, const float* z, const float* radius, uint32_t const count, uint8_t* visible ) const
+{
+    uint32_t numVisible = 0;
+    uint32_t i = 0;
+
+#if defined(FRUSTUM_AVX)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 const x8 = _mm256_loadu_ps( x + i );
+        __m256 const y8 = _mm256_loadu_ps( y + i );
+        __m256 const z8 = _mm256_loadu_ps( z + i );
+        __m256 const negRadius8 = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_loadu_ps( radius + i ) );
+        __m256 inside = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+        for (const glm::vec4& plane : mPlanes)
+        {
+            __m256 dist = _mm256_add_ps( _mm256_mul_ps( x8, _mm256_set1_ps( plane.x ) ), _mm256_set1_ps( plane.w ) );
+            dist = _mm256_add_ps( dist, _mm256_mul_ps( y8, _mm256_set1_ps( plane.y ) ) );
+            dist = _mm256_add_ps( dist, _mm256_mul_ps( z8, _mm256_set1_ps( plane.z ) ) );
+            inside = _mm256_and_ps( inside, _mm256_cmp_ps( dist, negRadius8, _CMP_GE_OQ ) );
+        }
+        int const mask = _mm256_movemask_ps( inside );
+        for (uint32_t lane = 0; lane < 8; lane++)
+        {
+            visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+            numVisible += (mask >> lane) & 1;
+        }
+    }
+#elif defined(FRUSTUM_SSE)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 const x4 = _mm_loadu_ps( x + i );
+        __m128 const y4 = _mm_loadu_ps( y + i );
+        __m128 const z4 = _mm_loadu_ps( z + i );
+        __m128 const negRadius4 = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( radius + i ) );
+        __m128 inside = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+        for (const glm::vec4& plane : mPlanes)
+        {
+            __m128 dist = _mm_add_ps( _mm_mul_ps( x4, _mm_set1_ps( plane.x ) ), _mm_set1_ps( plane.w ) );
+            dist = _mm_add_ps( dist, _mm_mul_ps( y4, _mm_set1_ps( plane.y ) ) );
+            dist = _mm_add_ps( dist, _mm_mul_ps( z4, _mm_set1_ps( plane.z ) ) );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( dist, negRadius4 ) );
+        }
+        int const mask = _mm_movemask_ps( inside );
+        for (uint32_t lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+            numVisible += (mask >> lane) & 1;
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        visible[i] = IntersectsSphere( glm::vec3( x[i], y[i], z[i] ), radius[i] ) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    return numVisible;
+}
+
+//=============================================================================
+
+#endif
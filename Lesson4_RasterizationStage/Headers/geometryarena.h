@@ -0,0 +1,137 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include <glstate.h>
+#include <mesh.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+// Every mesh's vertices and indices packed into one vertex buffer and one
+// index buffer behind a single VAO. A mesh becomes a range of the buffers:
+// drawing it is glDrawElementsBaseVertex, or a command of a multi draw
+// indirect, and never a VAO switch.
+//
+// Add meshes while loading, then Upload once; the CPU copies are freed.
+//=============================================================================
+
+struct GeometryRange
+{
+    uint32_t mFirstIndex;
+    uint32_t mIndexCount;
+    int32_t mBaseVertex;
+};
+
+//=============================================================================
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER.
+//=============================================================================
+
+struct DrawElementsIndirectCommand
+{
+    uint32_t mCount;
+    uint32_t mInstanceCount;
+    uint32_t mFirstIndex;
+    int32_t mBaseVertex;
+    uint32_t mBaseInstance;
+};
+
+//=============================================================================
+
+class GeometryArena
+{
+public:
+    GeometryArena(): mVertexArray( 0 ), mVertexBuffer( 0 ), mIndexBuffer( 0 ) {}
+    ~GeometryArena();
+    GeometryArena( const GeometryArena& ) = delete;
+    GeometryArena& operator=( const GeometryArena& ) = delete;
+
+    GeometryRange Add( const Mesh& mesh );
+    void Upload();
+
+    // Feed a per instance vec4 attribute from buffer. With baseInstance set,
+    // each draw starts at its own element, so one binding serves all draws.
+    void AttachInstances( GLuint const buffer, GLuint const location );
+
+    void Bind() const { GetGLState().BindVertexArray( mVertexArray ); }
+    bool IsUploaded() const { return mVertexArray != 0; }
+
+private:
+    std::vector<Vertex> mVertices;
+    std::vector<unsigned int> mIndices;
+    GLuint mVertexArray;
+    GLuint mVertexBuffer;
+    GLuint mIndexBuffer;
+};
+
+//=============================================================================
+
+inline GeometryArena::~GeometryArena()
+{
+    if (mVertexArray != 0)
+    {
+        glDeleteVertexArrays( 1, &mVertexArray );
+        glDeleteBuffers( 1, &mVertexBuffer );
+        glDeleteBuffers( 1, &mIndexBuffer );
+    }
+}
+
+//=============================================================================
+
+inline GeometryRange GeometryArena::Add( const Mesh& mesh )
+{
+    // Indices stay relative to the mesh; the base vertex offsets them at draw time.
+    GeometryRange const range = { (uint32_t)mIndices.size(), (uint32_t)mesh.indices.size(), (int32_t)mVertices.size() };
+    mVertices.insert( mVertices.end(), mesh.vertices.begin(), mesh.vertices.end() );
+    mIndices.insert( mIndices.end(), mesh.indices.begin(), mesh.indices.end() );
+    return range;
+}
+
+//=============================================================================
+
+inline void GeometryArena::Upload()
+{
+    // Same attribute layout as Mesh::setupMesh.
+    glGenVertexArrays( 1, &mVertexArray );
+    glGenBuffers( 1, &mVertexBuffer );
+    glGenBuffers( 1, &mIndexBuffer );
+
+    Bind();
+    glBindBuffer( GL_ARRAY_BUFFER, mVertexBuffer );
+    glBufferData( GL_ARRAY_BUFFER, mVertices.size() * sizeof( Vertex ), mVertices.data(), GL_STATIC_DRAW );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, mIndices.size() * sizeof( unsigned int ), mIndices.data(), GL_STATIC_DRAW );
+
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)offsetof( Vertex, Position ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)offsetof( Vertex, Normal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)offsetof( Vertex, TexCoords ) );
+    glEnableVertexAttribArray( 3 );
+    glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)offsetof( Vertex, Tangent ) );
+    glEnableVertexAttribArray( 4 );
+    glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), (void*)offsetof( Vertex, Bitangent ) );
+    GetGLState().BindVertexArray( 0 );
+
+    std::vector<Vertex>().swap( mVertices );
+    std::vector<unsigned int>().swap( mIndices );
+}
+
+//=============================================================================
+
+inline void GeometryArena::AttachInstances( GLuint const buffer, GLuint const location )
+{
+    Bind();
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+    glEnableVertexAttribArray( location );
+    glVertexAttribPointer( location, 4, GL_FLOAT, GL_FALSE, sizeof( glm::vec4 ), (void*)0 );
+    glVertexAttribDivisor( location, 1 );
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+//=============================================================================
+// Shadow copy of the GL binding state. Every program, texture unit and vertex
+// array bind goes through here; a bind of what is already bound never reaches
+// the driver. Counters record the calls issued and the calls filtered, so the
+// saving shows up per frame.
+//
+// The shadow only stays right if nothing binds behind its back. Code that
+// has to call GL directly calls Invalidate afterwards. Not thread safe: the
+// thread owning the GL context owns GetGLState().
+//=============================================================================
+
+struct GLStateStats
+{
+    uint32_t mPrograms;         // glUseProgram calls issued
+    uint32_t mActiveTextures;   // glActiveTexture calls issued
+    uint32_t mTextures;         // glBindTexture calls issued
+    uint32_t mVertexArrays;     // glBindVertexArray calls issued
+    uint32_t mFiltered;         // binds dropped because the state was already set
+
+    uint32_t GetIssued() const { return mPrograms + mActiveTextures + mTextures + mVertexArrays; }
+};
+
+//=============================================================================
+
+class GLState
+{
+public:
+    static uint32_t const MAX_TEXTURE_UNITS = 32;
+
+    GLState() { Invalidate(); ResetStats(); }
+
+    void UseProgram( GLuint const program );
+    void ActiveTexture( uint32_t const unit );
+    // Binds a GL_TEXTURE_2D to the unit, switching the active unit only if the binding changes.
+    void BindTexture( uint32_t const unit, GLuint const texture );
+    void BindVertexArray( GLuint const vao );
+
+    // Forget the shadow state; the next bind of each kind goes to GL.
+    void Invalidate();
+
+    GLuint GetProgram() const { return mProgram; }
+
+    const GLStateStats& GetStats() const { return mStats; }
+    void ResetStats() { memset( &mStats, 0, sizeof( mStats ) ); }
+
+private:
+    static GLuint const UNKNOWN = ~0u;
+
+    GLuint mProgram;
+    uint32_t mActiveUnit;
+    GLuint mTextures[MAX_TEXTURE_UNITS];
+    GLuint mVertexArray;
+    GLStateStats mStats;
+};
+
+//=============================================================================
+
+inline void GLState::UseProgram( GLuint const program )
+{
+    if (program == mProgram)
+    {
+        mStats.mFiltered++;
+        return;
+    }
+    glUseProgram( program );
+    mProgram = program;
+    mStats.mPrograms++;
+}
+
+//=============================================================================
+
+inline void GLState::ActiveTexture( uint32_t const unit )
+{
+    assert( unit < MAX_TEXTURE_UNITS );
+    if (unit == mActiveUnit)
+    {
+        mStats.mFiltered++;
+        return;
+    }
+    glActiveTexture( GL_TEXTURE0 + unit );
+    mActiveUnit = unit;
+    mStats.mActiveTextures++;
+}
+
+//=============================================================================
+
+inline void GLState::BindTexture( uint32_t const unit, GLuint const texture )
+{
+    assert( unit < MAX_TEXTURE_UNITS );
+    if (texture == mTextures[unit])
+    {
+        mStats.mFiltered++;
+        return;
+    }
+    ActiveTexture( unit );
+    glBindTexture( GL_TEXTURE_2D, texture );
+    mTextures[unit] = texture;
+    mStats.mTextures++;
+}
+
+//=============================================================================
+
+inline void GLState::BindVertexArray( GLuint const vao )
+{
+    if (vao == mVertexArray)
+    {
+        mStats.mFiltered++;
+        return;
+    }
+    glBindVertexArray( vao );
+    mVertexArray = vao;
+    mStats.mVertexArrays++;
+}
+
+//=============================================================================
+
+inline void GLState::Invalidate()
+{
+    mProgram = UNKNOWN;
+    mActiveUnit = UNKNOWN;
+    for (uint32_t i = 0; i < MAX_TEXTURE_UNITS; i++)
+    {
+        mTextures[i] = UNKNOWN;
+    }
+    mVertexArray = UNKNOWN;
+}
+
+//=============================================================================
+
+inline GLState& GetGLState()
+{
+    static GLState state;
+    return state;
+}
+
+//=============================================================================
+
+#endif
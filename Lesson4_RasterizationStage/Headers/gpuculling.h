@@ -0,0 +1,233 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <geometryarena.h>
+#include <glstate.h>
+#include <shader.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//=============================================================================
+// Instance culling in compute shaders, GL 4.3. The CPU streams every
+// instance, grouped by model, and one thread per instance tests its model's
+// bounding sphere against the view and against a max depth pyramid of the
+// previous frame. Survivors are appended to their model's part of the
+// output with an atomic counter, and a second pass copies each model's
+// count into the instance count of its indirect draw commands, so the CPU
+// never learns, or waits for, what is visible.
+//
+//   Cull( buffer, ranges, ... )    before the draws, which read the output
+//   BuildPyramid( size, vp )       after them, from the depth just drawn
+//
+// The pyramid is the previous frame's, so the test projects with the
+// previous view projection. Anything off its screen or reaching behind its
+// camera counts as visible. Every buffer is a range of one caller's buffer,
+// e.g. the stream buffer; offsets must honor
+// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT. Owned by the thread with the GL
+// context, like GetGLState().
+//=============================================================================
+
+// std430 mirror of the Params buffer in shaders/gpucull.cs.
+struct GpuCullParams
+{
+    static uint32_t const MAX_MODELS = 8;     // MAX_MODELS in shaders/gpucull.cs
+
+    glm::mat4 mPrevViewProjection;          // set by GpuCulling::FillParams
+    glm::vec4 mPlanes[6];                   // this frame's, see Frustum
+    glm::vec4 mModelSpheres[MAX_MODELS];    // model space center xyz, radius
+    uint32_t mInstanceCount;
+    uint32_t mModelCount;
+    uint32_t mHiZ;                          // set by GpuCulling::FillParams
+    uint32_t mPad;
+    uint32_t mModelFirst[MAX_MODELS + 1];   // instance ranges by model, plus the total
+};
+
+//=============================================================================
+
+// Byte offsets of Cull's buffers in the caller's buffer.
+struct GpuCullRanges
+{
+    size_t mParams;
+    size_t mInstances;      // vec4 each
+    size_t mVisible;        // vec4 each, as many as mInstances
+    size_t mCounts;         // uint per model
+    size_t mCommands;       // DrawElementsIndirectCommand each
+    size_t mCommandModels;  // uint per command: model whose count it draws, ~0u to leave it alone
+};
+
+//=============================================================================
+
+class GpuCulling
+{
+public:
+    GpuCulling(): mDepth( 0 ), mPyramid( 0 ), mDepthSize( 0 ), mPyramidLevels( 0 ), mPrevViewProjection( 1.0f ), mPyramidValid( false ) {}
+    ~GpuCulling() { DestroyTextures(); }
+    GpuCulling( const GpuCulling& ) = delete;
+    GpuCulling& operator=( const GpuCulling& ) = delete;
+
+    static bool IsSupported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+    void Create( const char* cullPath, const char* commandsPath, const char* pyramidPath );
+    bool IsCreated() const { return mCull != nullptr; }
+
+    // params are written into buffer at ranges.mParams, and the counts zeroed there, before this runs.
+    void Cull( GLuint const buffer, const GpuCullRanges& ranges, uint32_t const instanceCount, uint32_t const commandCount );
+    // The pyramid part of the params: the view projection it was drawn with and whether there is one.
+    void FillParams( GpuCullParams& params ) const;
+    // From the read framebuffer's depth, before the swap; a new size starts a new pyramid.
+    void BuildPyramid( const glm::ivec2& size, const glm::mat4& viewProjection );
+    // The next Cull tests against the view only, e.g. after a frame drawn without this.
+    void InvalidatePyramid() { mPyramidValid = false; }
+
+private:
+    static GLuint const GROUP_SIZE = 64;        // local_size_x in shaders/gpucull.cs and gpucommands.cs
+    static GLuint const PYRAMID_GROUP_SIZE = 8; // local_size_x and _y in shaders/depthpyramid.cs
+
+    void DestroyTextures();
+
+    std::unique_ptr<Shader> mCull;
+    std::unique_ptr<Shader> mCommands;
+    std::unique_ptr<Shader> mPyramidBuild;
+    Uniform<int> mCommandCount;
+    Uniform<int> mSourceLevel;
+    GLint mCullPyramidUnit;
+    GLint mBuildSourceUnit;
+    GLuint mDepth;              // copy of the depth buffer
+    GLuint mPyramid;            // r32f, level 0 is half the depth buffer's size
+    glm::ivec2 mDepthSize;
+    uint32_t mPyramidLevels;
+    glm::mat4 mPrevViewProjection;
+    bool mPyramidValid;
+};
+
+//=============================================================================
+
+inline void GpuCulling::Create( const char* cullPath, const char* commandsPath, const char* pyramidPath )
+{
+    mCull.reset( new Shader( cullPath ) );
+    mCommands.reset( new Shader( commandsPath ) );
+    mPyramidBuild.reset( new Shader( pyramidPath ) );
+    mCommandCount = mCommands->getUniform<int>( "commandCount" );
+    mSourceLevel = mPyramidBuild->getUniform<int>( "sourceLevel" );
+    mCullPyramidUnit = mCull->getSamplerUnit( "pyramid" );
+    mBuildSourceUnit = mPyramidBuild->getSamplerUnit( "source" );
+}
+
+//=============================================================================
+
+inline void GpuCulling::FillParams( GpuCullParams& params ) const
+{
+    params.mPrevViewProjection = mPrevViewProjection;
+    params.mHiZ = mPyramidValid ? 1 : 0;
+}
+
+//=============================================================================
+
+inline void GpuCulling::Cull( GLuint const buffer, const GpuCullRanges& ranges, uint32_t const instanceCount, uint32_t const commandCount )
+{
+    if (instanceCount == 0)
+        return;
+
+    // Binding points are the layout( binding ) of the shaders' buffers.
+    glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 0, buffer, (GLintptr)ranges.mInstances, (GLsizeiptr)(sizeof( glm::vec4 ) * instanceCount) );
+    glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 1, buffer, (GLintptr)ranges.mVisible, (GLsizeiptr)(sizeof( glm::vec4 ) * instanceCount) );
+    glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 2, buffer, (GLintptr)ranges.mCounts, (GLsizeiptr)(sizeof( uint32_t ) * GpuCullParams::MAX_MODELS) );
+    glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 3, buffer, (GLintptr)ranges.mParams, (GLsizeiptr)sizeof( GpuCullParams ) );
+    mCull->use();
+    if (mCullPyramidUnit >= 0 && mPyramid != 0)
+    {
+        GetGLState().BindTexture( (uint32_t)mCullPyramidUnit, mPyramid );
+    }
+    glDispatchCompute( (instanceCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1 );
+
+    if (commandCount > 0)
+    {
+        glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT );
+        glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 4, buffer, (GLintptr)ranges.mCommands, (GLsizeiptr)(sizeof( DrawElementsIndirectCommand ) * commandCount) );
+        glBindBufferRange( GL_SHADER_STORAGE_BUFFER, 5, buffer, (GLintptr)ranges.mCommandModels, (GLsizeiptr)(sizeof( uint32_t ) * commandCount) );
+        mCommands->use();
+        mCommands->set( mCommandCount, (int)commandCount );
+        glDispatchCompute( (commandCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1 );
+    }
+
+    // The draws read the commands and the visible instances next.
+    glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT );
+}
+
+//=============================================================================
+
+inline void GpuCulling::BuildPyramid( const glm::ivec2& size, const glm::mat4& viewProjection )
+{
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    if (size != mDepthSize)
+    {
+        DestroyTextures();
+        mDepthSize = size;
+        glm::ivec2 const levelSize = glm::max( size / 2, glm::ivec2( 1 ) );
+        mPyramidLevels = 1;
+        while ((levelSize.x >> mPyramidLevels) > 0 || (levelSize.y >> mPyramidLevels) > 0)
+        {
+            mPyramidLevels++;
+        }
+
+        // Bound through the state tracker's unit 0; it is what the next bind there expects.
+        glGenTextures( 1, &mDepth );
+        GetGLState().BindTexture( 0, mDepth );
+        glTexStorage2D( GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, size.x, size.y );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE );
+
+        glGenTextures( 1, &mPyramid );
+        GetGLState().BindTexture( 0, mPyramid );
+        glTexStorage2D( GL_TEXTURE_2D, (GLsizei)mPyramidLevels, GL_R32F, levelSize.x, levelSize.y );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        mPyramidValid = false;
+    }
+
+    GetGLState().BindTexture( 0, mDepth );
+    glCopyTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, 0, 0, size.x, size.y );
+
+    // Each level is the max of the 2x2 texels above it, level 0 of the depth copy.
+    mPyramidBuild->use();
+    glm::ivec2 levelSize = glm::max( size / 2, glm::ivec2( 1 ) );
+    for (uint32_t level = 0; level < mPyramidLevels; level++)
+    {
+        GetGLState().BindTexture( (uint32_t)mBuildSourceUnit, level == 0 ? mDepth : mPyramid );
+        mPyramidBuild->set( mSourceLevel, level == 0 ? 0 : (int)level - 1 );
+        glBindImageTexture( 0, mPyramid, (GLint)level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+        glDispatchCompute( ((GLuint)levelSize.x + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, ((GLuint)levelSize.y + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1 );
+        glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+        levelSize = glm::max( levelSize / 2, glm::ivec2( 1 ) );
+    }
+    mPrevViewProjection = viewProjection;
+    mPyramidValid = true;
+}
+
+//=============================================================================
+
+inline void GpuCulling::DestroyTextures()
+{
+    if (mDepth != 0)
+    {
+        glDeleteTextures( 1, &mDepth );
+        glDeleteTextures( 1, &mPyramid );
+        GetGLState().Invalidate();
+    }
+    mDepth = 0;
+    mPyramid = 0;
+    mDepthSize = glm::ivec2( 0 );
+    mPyramidValid = false;
+}
+
+//=============================================================================
+
+#endif
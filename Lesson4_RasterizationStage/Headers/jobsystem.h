@@ -0,0 +1,264 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//=============================================================================
+// Work stealing scheduler. Every thread owns a bounded deque: it pushes and
+// pops jobs at the back, idle threads steal from the front of the others.
+// The thread that constructed the JobSystem is thread 0 and joins in while it
+// waits on a ParallelFor, so a single core machine simply runs inline.
+//=============================================================================
+
+class JobSystem
+{
+public:
+    explicit JobSystem( uint32_t const numWorkers = DefaultWorkerCount() );
+    ~JobSystem();
+    JobSystem( const JobSystem& ) = delete;
+    JobSystem& operator=( const JobSystem& ) = delete;
+
+    // Calls fn( chunkBegin, chunkEnd ) over [begin, end) split into grain sized
+    // chunks and returns once every chunk has run. Chunk boundaries depend only
+    // on the arguments, never on the thread count.
+    template<typename Fn>
+    void ParallelFor( uint32_t const begin, uint32_t const end, uint32_t const grain, const Fn& fn );
+
+    uint32_t GetThreadCount() const { return (uint32_t)mQueues.size(); }
+
+    static uint32_t DefaultWorkerCount()
+    {
+        uint32_t const cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
+
+private:
+    struct Job
+    {
+        void (*mFunc)( const void* context, uint32_t begin, uint32_t end );
+        const void* mContext;
+        uint32_t mBegin;
+        uint32_t mEnd;
+        std::atomic<uint32_t>* mPending;
+    };
+
+    struct Queue
+    {
+        static uint32_t const CAPACITY = 4096;
+
+        bool Push( const Job& job );
+        bool Pop( Job& job );
+        bool Steal( Job& job );
+
+        std::mutex mLock;
+        Job mJobs[CAPACITY];
+        uint32_t mHead = 0;     // steal end
+        uint32_t mTail = 0;     // owner end
+    };
+
+    template<typename Fn>
+    static void Trampoline( const void* context, uint32_t const begin, uint32_t const end )
+    {
+        (*static_cast<const Fn*>( context ))( begin, end );
+    }
+
+    static uint32_t& ThreadIndex()
+    {
+        static thread_local uint32_t index = 0;
+        return index;
+    }
+
+    void WorkerMain( uint32_t const index );
+    bool FindJob( uint32_t const index, Job& job );
+    void Run( const Job& job );
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mWorkers;
+    std::atomic<uint32_t> mQueuedJobs;
+    std::mutex mWakeLock;
+    std::condition_variable mWake;
+    bool mQuit;
+};
+
+//=============================================================================
+
+inline bool JobSystem::Queue::Push( const Job& job )
+{
+    std::lock_guard<std::mutex> lock( mLock );
+    if (mTail - mHead == CAPACITY)
+        return false;
+    mJobs[mTail++ % CAPACITY] = job;
+    return true;
+}
+
+//=============================================================================
+
+inline bool JobSystem::Queue::Pop( Job& job )
+{
+    std::lock_guard<std::mutex> lock( mLock );
+    if (mTail == mHead)
+        return false;
+    job = mJobs[--mTail % CAPACITY];
+    return true;
+}
+
+//=============================================================================
+
+inline bool JobSystem::Queue::Steal( Job& job )
+{
+    std::lock_guard<std::mutex> lock( mLock );
+    if (mTail == mHead)
+        return false;
+    job = mJobs[mHead++ % CAPACITY];
+    return true;
+}
+
+//=============================================================================
+
+inline JobSystem::JobSystem( uint32_t const numWorkers ):
+    mQueuedJobs( 0 ),
+    mQuit( false )
+{
+    ThreadIndex() = 0;
+    for (uint32_t i = 0; i <= numWorkers; i++)
+    {
+        mQueues.push_back( std::unique_ptr<Queue>( new Queue ) );
+    }
+    for (uint32_t i = 1; i <= numWorkers; i++)
+    {
+        mWorkers.push_back( std::thread( &JobSystem::WorkerMain, this, i ) );
+    }
+}
+
+//=============================================================================
+
+inline JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock( mWakeLock );
+        mQuit = true;
+    }
+    mWake.notify_all();
+    for (auto& worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+//=============================================================================
+
+inline void JobSystem::WorkerMain( uint32_t const index )
+{
+    ThreadIndex() = index;
+    for (;;)
+    {
+        Job job;
+        if (FindJob( index, job ))
+        {
+            Run( job );
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( mWakeLock );
+        mWake.wait( lock, [this]() { return mQuit || mQueuedJobs.load( std::memory_order_acquire ) > 0; } );
+        if (mQuit)
+            return;
+    }
+}
+
+//=============================================================================
+
+inline bool JobSystem::FindJob( uint32_t const index, Job& job )
+{
+    uint32_t const count = (uint32_t)mQueues.size();
+    bool found = mQueues[index]->Pop( job );
+    for (uint32_t i = 1; !found && i < count; i++)
+    {
+        found = mQueues[(index + i) % count]->Steal( job );
+    }
+    if (found)
+    {
+        mQueuedJobs.fetch_sub( 1, std::memory_order_relaxed );
+    }
+    return found;
+}
+
+//=============================================================================
+
+inline void JobSystem::Run( const Job& job )
+{
+    job.mFunc( job.mContext, job.mBegin, job.mEnd );
+    job.mPending->fetch_sub( 1, std::memory_order_release );
+}
+
+//=============================================================================
+
+template<typename Fn>
+void JobSystem::ParallelFor( uint32_t const begin, uint32_t const end, uint32_t const grain, const Fn& fn )
+{
+    if (end <= begin)
+        return;
+
+    uint32_t const step = std::max( grain, 1u );
+    uint32_t const numChunks = (end - begin + step - 1) / step;
+    if (numChunks == 1 || mWorkers.empty())
+    {
+        // Inline, but still chunk by chunk, so callers see the same boundaries.
+        for (uint32_t c = 0; c < numChunks; c++)
+        {
+            uint32_t const chunkBegin = begin + c * step;
+            fn( chunkBegin, std::min( chunkBegin + step, end ) );
+        }
+        return;
+    }
+
+    // Push in reverse so the owner pops the chunks front to back while
+    // thieves take them from the far end.
+    std::atomic<uint32_t> pending( numChunks );
+    uint32_t const index = ThreadIndex();
+    Queue& queue = *mQueues[index];
+    for (uint32_t c = numChunks; c > 0; c--)
+    {
+        Job job;
+        job.mFunc = &Trampoline<Fn>;
+        job.mContext = &fn;
+        job.mBegin = begin + (c - 1) * step;
+        job.mEnd = std::min( job.mBegin + step, end );
+        job.mPending = &pending;
+        mQueuedJobs.fetch_add( 1, std::memory_order_release );
+        if (!queue.Push( job ))
+        {
+            mQueuedJobs.fetch_sub( 1, std::memory_order_relaxed );
+            Run( job );
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock( mWakeLock );
+    }
+    mWake.notify_all();
+
+    // Help out until our chunks are done, possibly running other work too.
+    while (pending.load( std::memory_order_acquire ) > 0)
+    {
+        Job job;
+        if (FindJob( index, job ))
+        {
+            Run( job );
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
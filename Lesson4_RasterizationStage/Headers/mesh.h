@@ -6,6 +6,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <bounds.h>
+#include <glstate.h>
 #include <shader.h>
 
 #include <string>
@@ -40,6 +42,7 @@ public:
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
+    Bounds bounds;          // in model space, for culling
     unsigned int VAO;
 
     /*  Functions  */
@@ -49,53 +52,134 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->bounds = Bounds();
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader shader) 
+    // resolve this mesh's textures against a program's samplers, once at load time.
+    // the result is a compact table of (texture unit, texture) pairs for that program.
+    void BindMaterial(const Shader& shader)
     {
-        // bind appropriate textures
+        if (findMaterial(shader.ID) != nullptr)
+            return;
+
+        MaterialBinding material;
+        material.program = shader.ID;
+        material.firstBinding = (unsigned int)textureBindings.size();
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
+            unsigned int number = 0;
+            const string& name = textures[i].type;
             if(name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
+				number = diffuseNr++;
 			else if(name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
+				number = specularNr++;
             else if(name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
+				number = normalNr++;
              else if(name == "texture_height")
-			    number = std::to_string(heightNr++); // transfer unsigned int to stream
+			    number = heightNr++;
 
-													 // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            // the program fixed each sampler's texture unit when it was linked; textures it doesn't sample are dropped
+            string samplerName = number != 0 ? name + std::to_string(number) : name;
+            GLint unit = shader.getSamplerUnit(samplerName.c_str());
+            if (unit >= 0)
+                textureBindings.push_back(TextureBinding{ (unsigned int)unit, textures[i].id });
         }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
+        material.numBindings = (unsigned int)textureBindings.size() - material.firstBinding;
+        materials.push_back(material);
+    }
+
+    // render the mesh
+    void Draw(const Shader& shader)
+    {
+        BindTextures(shader);
+        BindGeometry();
+        DrawElements();
+    }
+
+    // the pieces of Draw, for callers that sort draws and skip state that didn't change.
+    // binds go through the GL state tracker and stay bound; nothing is reset between meshes.
+    void BindTextures(const Shader& shader)
+    {
+        // bind appropriate textures from the program's binding table
+        const MaterialBinding* material = findMaterial(shader.ID);
+        if (material == nullptr)
+        {
+            // not bound at load time; do it now, once
+            BindMaterial(shader);
+            material = findMaterial(shader.ID);
+        }
+        for(unsigned int i = 0; i < material->numBindings; i++)
+        {
+            const TextureBinding& binding = textureBindings[material->firstBinding + i];
+            GetGLState().BindTexture(binding.unit, binding.texture);
+        }
+    }
+
+    void BindGeometry() const
+    {
+        GetGLState().BindVertexArray(VAO);
+    }
+
+    void DrawElements() const
+    {
         glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // feed a vec4 vertex attribute from buffer, advancing once per instance, starting offset
+    // bytes in. binds the VAO; the pointer is VAO state, so it holds until the next call.
+    void BindInstances(GLuint buffer, GLuint location, size_t offset) const
+    {
+        GetGLState().BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)offset);
+        glVertexAttribDivisor(location, 1);
+    }
+
+    void DrawElementsInstanced(GLsizei instanceCount) const
+    {
+        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0, instanceCount);
     }
 
 private:
     /*  Render data  */
     unsigned int VBO, EBO;
 
+    struct TextureBinding
+    {
+        unsigned int unit;
+        unsigned int texture;
+    };
+
+    struct MaterialBinding
+    {
+        unsigned int program;
+        unsigned int firstBinding;  // into textureBindings
+        unsigned int numBindings;
+    };
+
+    // one binding table per program the mesh is drawn with; usually just one
+    vector<MaterialBinding> materials;
+    vector<TextureBinding> textureBindings;
+
+    const MaterialBinding* findMaterial(unsigned int program) const
+    {
+        for (const MaterialBinding& material : materials)
+        {
+            if (material.program == program)
+                return &material;
+        }
+        return nullptr;
+    }
+
     /*  Functions    */
     // initializes all the buffer objects/arrays
     void setupMesh()
@@ -105,7 +189,7 @@ private:
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GetGLState().BindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
@@ -133,7 +217,7 @@ private:
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
-        glBindVertexArray(0);
+        GetGLState().BindVertexArray(0);
     }
 };
 #endif
@@ -30,22 +30,30 @@ public:
     /*  Model Data */
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh> meshes;
+    Bounds bounds;      // around all meshes, in model space
     string directory;
     bool gammaCorrection;
 
     /*  Functions   */
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false) : bounds(), gammaCorrection(gamma)
     {
         loadModel(path);
     }
 
     // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    void Draw(const Shader& shader)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
+
+    // resolve every mesh's textures against the program's samplers; call once at load
+    void BindMaterials(const Shader& shader)
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].BindMaterial(shader);
+    }
     
 private:
     /*  Functions   */
@@ -66,6 +74,10 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // combine the meshes' bounds into the model's
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            bounds = i == 0 ? meshes[i].bounds : Bounds::Merge(bounds, meshes[i].bounds);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -163,8 +175,10 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return a mesh object created from the extracted mesh data, with its bounding box and sphere
+        Mesh result(vertices, indices, textures);
+        result.bounds = Bounds::FromPoints(vertices.empty() ? nullptr : &vertices[0].Position, vertices.size(), sizeof(Vertex));
+        return result;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -222,7 +236,7 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        GetGLState().BindTexture(0, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -0,0 +1,230 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//=============================================================================
+// 32 bit generational handle: the low bits index a pool slot, the high bits
+// hold the slot's generation when the handle was made. Destroying an object
+// bumps its slot's generation, so stale handles resolve to nullptr instead of
+// whatever reused the slot. The type parameter keeps handles of different
+// pools apart; a zero handle is null.
+//=============================================================================
+
+template<typename T>
+struct PoolHandle
+{
+    static uint32_t const INDEX_BITS = 22;
+    static uint32_t const INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static uint32_t const GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+
+    PoolHandle(): mValue( 0 ) {}
+    PoolHandle( uint32_t const index, uint32_t const generation ): mValue( (generation << INDEX_BITS) | index ) {}
+
+    uint32_t GetIndex() const { return mValue & INDEX_MASK; }
+    uint32_t GetGeneration() const { return mValue >> INDEX_BITS; }
+    bool IsNull() const { return mValue == 0; }
+
+    bool operator==( const PoolHandle& other ) const { return mValue == other.mValue; }
+    bool operator!=( const PoolHandle& other ) const { return mValue != other.mValue; }
+
+    uint32_t mValue;
+};
+
+//=============================================================================
+// Typed object pool. Objects live in fixed size slabs that never move, so
+// pointers stay valid until the object is destroyed. Free slots are reused
+// most recently freed first; once the pool has grown (or been reserved) to
+// its peak size, creating and destroying objects never touches the heap.
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE = 256>
+class ObjectPool
+{
+public:
+    typedef PoolHandle<T> Handle;
+
+    ObjectPool(): mCount( 0 ) {}
+    ~ObjectPool();
+    ObjectPool( const ObjectPool& ) = delete;
+    ObjectPool& operator=( const ObjectPool& ) = delete;
+
+    // Grow to at least 'count' slots up front.
+    void Reserve( uint32_t const count );
+
+    template<typename... Args>
+    Handle Create( Args&&... args );
+    void Destroy( Handle const handle );
+
+    // nullptr if the handle is null or its object has been destroyed.
+    T* Get( Handle const handle );
+    const T* Get( Handle const handle ) const;
+    bool IsValid( Handle const handle ) const { return Resolve( handle ) != INVALID_INDEX; }
+
+    uint32_t GetCount() const { return mCount; }
+
+    // Visit live objects in slot order; fn( T& ).
+    template<typename Fn>
+    void ForEach( Fn fn );
+    template<typename Fn>
+    void ForEach( Fn fn ) const;
+
+private:
+    static uint32_t const INVALID_INDEX = ~0u;
+
+    typedef typename std::aligned_storage<sizeof( T ), alignof( T )>::type Storage;
+
+    void AddSlab();
+    uint32_t Resolve( Handle const handle ) const;
+    T* Slot( uint32_t const index ) const { return reinterpret_cast<T*>( &mSlabs[index / SLAB_SIZE][index % SLAB_SIZE] ); }
+
+    std::vector<std::unique_ptr<Storage[]>> mSlabs;
+    std::vector<uint32_t> mGeneration;  // per slot, odd while the slot is live
+    std::vector<uint32_t> mFreeList;    // stack of free slot indices
+    uint32_t mCount;
+};
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+ObjectPool<T, SLAB_SIZE>::~ObjectPool()
+{
+    ForEach( []( T& object ) { object.~T(); } );
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+void ObjectPool<T, SLAB_SIZE>::Reserve( uint32_t const count )
+{
+    while (mGeneration.size() < count)
+    {
+        AddSlab();
+    }
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+void ObjectPool<T, SLAB_SIZE>::AddSlab()
+{
+    uint32_t const first = (uint32_t)mGeneration.size();
+    assert( first + SLAB_SIZE - 1 <= Handle::INDEX_MASK );
+    mSlabs.push_back( std::unique_ptr<Storage[]>( new Storage[SLAB_SIZE] ) );
+    mGeneration.resize( first + SLAB_SIZE, 0 );
+
+    // The free list can hold every slot, so Destroy never has to grow it.
+    // Push in reverse so the lowest new slot is handed out first.
+    mFreeList.reserve( mGeneration.size() );
+    for (uint32_t i = first + SLAB_SIZE; i > first; i--)
+    {
+        mFreeList.push_back( i - 1 );
+    }
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+template<typename... Args>
+typename ObjectPool<T, SLAB_SIZE>::Handle ObjectPool<T, SLAB_SIZE>::Create( Args&&... args )
+{
+    if (mFreeList.empty())
+    {
+        AddSlab();
+    }
+    uint32_t const index = mFreeList.back();
+    new (Slot( index )) T( std::forward<Args>( args )... );
+    mFreeList.pop_back();
+
+    // Live generations are odd, so a handle is never zero.
+    uint32_t& generation = mGeneration[index];
+    generation = (generation + 1) & Handle::GENERATION_MASK;
+    mCount++;
+    return Handle( index, generation );
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+void ObjectPool<T, SLAB_SIZE>::Destroy( Handle const handle )
+{
+    uint32_t const index = Resolve( handle );
+    if (index == INVALID_INDEX)
+        return;
+
+    Slot( index )->~T();
+    mGeneration[index] = (mGeneration[index] + 1) & Handle::GENERATION_MASK;
+    mFreeList.push_back( index );
+    mCount--;
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+uint32_t ObjectPool<T, SLAB_SIZE>::Resolve( Handle const handle ) const
+{
+    uint32_t const index = handle.GetIndex();
+    if (handle.IsNull() || index >= mGeneration.size() || mGeneration[index] != handle.GetGeneration())
+        return INVALID_INDEX;
+    return index;
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+T* ObjectPool<T, SLAB_SIZE>::Get( Handle const handle )
+{
+    uint32_t const index = Resolve( handle );
+    return index != INVALID_INDEX ? Slot( index ) : nullptr;
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+const T* ObjectPool<T, SLAB_SIZE>::Get( Handle const handle ) const
+{
+    uint32_t const index = Resolve( handle );
+    return index != INVALID_INDEX ? Slot( index ) : nullptr;
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+template<typename Fn>
+void ObjectPool<T, SLAB_SIZE>::ForEach( Fn fn )
+{
+    uint32_t const count = (uint32_t)mGeneration.size();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (mGeneration[i] & 1)
+        {
+            fn( *Slot( i ) );
+        }
+    }
+}
+
+//=============================================================================
+
+template<typename T, uint32_t SLAB_SIZE>
+template<typename Fn>
+void ObjectPool<T, SLAB_SIZE>::ForEach( Fn fn ) const
+{
+    uint32_t const count = (uint32_t)mGeneration.size();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (mGeneration[i] & 1)
+        {
+            fn( static_cast<const T&>( *Slot( i ) ) );
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
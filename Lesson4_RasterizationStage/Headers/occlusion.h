@@ -0,0 +1,344 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+//=============================================================================
+// Low resolution software depth buffer for occlusion culling, all on the
+// CPU. A frame draws a few big occluders as boxes, builds a min/max depth
+// hierarchy, then asks per object whether its box could show in front of
+// what was drawn:
+//
+//   Begin( viewProjection ), DrawBox..., End(), IsVisible...
+//
+// Triangles are clipped against the near plane and filled with edge
+// functions, four pixels per step with SSE. Depth is z/w mapped to [0, 1];
+// a pixel keeps the nearest occluder depth.
+//
+// IsVisible projects the box, takes its nearest depth and its pixel rect,
+// and starts at the level where the rect covers only a few texels. The box
+// is hidden if it is behind the farthest depth in the rect; it is visible
+// for sure if it is in front of the nearest one. Otherwise the test goes one
+// level finer. It only reads, so any number of threads may call it at once.
+//=============================================================================
+
+class OcclusionBuffer
+{
+public:
+    // width is rounded up to a multiple of 4.
+    OcclusionBuffer( uint32_t const width, uint32_t const height );
+
+    void Begin( const glm::mat4& viewProjection );
+    // Draws the box [min, max] under transform; it must lie inside whatever it stands for.
+    void DrawBox( const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max );
+    void End();
+
+    // False only if the world space box is certainly behind the occluders.
+    bool IsVisible( const glm::vec3& min, const glm::vec3& max ) const;
+
+    uint32_t GetWidth() const { return mWidth; }
+    uint32_t GetHeight() const { return mHeight; }
+    uint32_t GetTriangleCount() const { return mTriangleCount; }    // drawn since Begin
+
+private:
+    // Texels a test may scan at one level before it settles for the coarser answer.
+    static uint32_t const MAX_TEST_TEXELS = 256;
+
+    struct Level
+    {
+        uint32_t mWidth;
+        uint32_t mHeight;
+        std::vector<float> mMin;    // empty for level 0, where min and max are the depth itself
+        std::vector<float> mMax;
+    };
+
+    void DrawTriangle( const glm::vec4& a, const glm::vec4& b, const glm::vec4& c );
+    void FillTriangle( const glm::vec3& a, const glm::vec3& b, const glm::vec3& c );
+    glm::vec3 ToScreen( const glm::vec4& clip ) const;
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    glm::mat4 mViewProjection;
+    std::vector<Level> mLevels;     // 0 is the depth buffer, each next one half the size
+    uint32_t mTriangleCount;
+};
+
+//=============================================================================
+
+inline OcclusionBuffer::OcclusionBuffer( uint32_t const width, uint32_t const height ):
+    mWidth( (width + 3) & ~3u ),
+    mHeight( height ),
+    mViewProjection( 1.0f ),
+    mTriangleCount( 0 )
+{
+    uint32_t levelWidth = mWidth;
+    uint32_t levelHeight = mHeight;
+    for (;;)
+    {
+        Level level;
+        level.mWidth = levelWidth;
+        level.mHeight = levelHeight;
+        level.mMax.resize( levelWidth * levelHeight, 1.0f );
+        if (!mLevels.empty())
+        {
+            level.mMin.resize( levelWidth * levelHeight, 1.0f );
+        }
+        mLevels.push_back( level );
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+}
+
+//=============================================================================
+
+inline void OcclusionBuffer::Begin( const glm::mat4& viewProjection )
+{
+    mViewProjection = viewProjection;
+    std::fill( mLevels[0].mMax.begin(), mLevels[0].mMax.end(), 1.0f );
+    mTriangleCount = 0;
+}
+
+//=============================================================================
+
+inline void OcclusionBuffer::DrawBox( const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max )
+{
+    // Corner i has max.x in bit 0, max.y in bit 1 and max.z in bit 2.
+    static uint8_t const indices[36] =
+    {
+        0, 2, 3, 0, 3, 1,   // -z
+        4, 5, 7, 4, 7, 6,   // +z
+        0, 1, 5, 0, 5, 4,   // -y
+        2, 6, 7, 2, 7, 3,   // +y
+        0, 4, 6, 0, 6, 2,   // -x
+        1, 3, 7, 1, 7, 5,   // +x
+    };
+    glm::mat4 const toClip = mViewProjection * transform;
+    glm::vec4 corners[8];
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        glm::vec3 const corner( (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z );
+        corners[i] = toClip * glm::vec4( corner, 1.0f );
+    }
+    for (uint32_t t = 0; t < 36; t += 3)
+    {
+        DrawTriangle( corners[indices[t]], corners[indices[t + 1]], corners[indices[t + 2]] );
+    }
+}
+
+//=============================================================================
+
+inline glm::vec3 OcclusionBuffer::ToScreen( const glm::vec4& clip ) const
+{
+    glm::vec3 const ndc = glm::vec3( clip ) / clip.w;
+    return glm::vec3( (ndc.x * 0.5f + 0.5f) * (float)mWidth, (ndc.y * 0.5f + 0.5f) * (float)mHeight, ndc.z * 0.5f + 0.5f );
+}
+
+//=============================================================================
+
+inline void OcclusionBuffer::DrawTriangle( const glm::vec4& a, const glm::vec4& b, const glm::vec4& c )
+{
+    // Clip against the near plane, z >= -w, which leaves a triangle or a quad.
+    glm::vec4 const in[3] = { a, b, c };
+    glm::vec4 out[4];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        const glm::vec4& from = in[i];
+        const glm::vec4& to = in[(i + 1) % 3];
+        float const fromDist = from.z + from.w;
+        float const toDist = to.z + to.w;
+        if (fromDist >= 0.0f)
+        {
+            out[count++] = from;
+        }
+        if ((fromDist >= 0.0f) != (toDist >= 0.0f))
+        {
+            out[count++] = from + (to - from) * (fromDist / (fromDist - toDist));
+        }
+    }
+    if (count < 3)
+        return;
+
+    glm::vec3 const first = ToScreen( out[0] );
+    glm::vec3 previous = ToScreen( out[1] );
+    for (uint32_t i = 2; i < count; i++)
+    {
+        glm::vec3 const next = ToScreen( out[i] );
+        FillTriangle( first, previous, next );
+        previous = next;
+    }
+    mTriangleCount++;
+}
+
+//=============================================================================
+
+inline void OcclusionBuffer::FillTriangle( const glm::vec3& a, const glm::vec3& b, const glm::vec3& c )
+{
+    // Edge functions are positive inside once the winding is made counter clockwise;
+    // occluders are solid, so both windings are drawn.
+    glm::vec3 v0 = a;
+    glm::vec3 v1 = b;
+    glm::vec3 v2 = c;
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (area == 0.0f)
+        return;
+    if (area < 0.0f)
+    {
+        std::swap( v1, v2 );
+        area = -area;
+    }
+
+    float const left = std::max( std::floor( std::min( v0.x, std::min( v1.x, v2.x ) ) ), 0.0f );
+    float const right = std::min( std::ceil( std::max( v0.x, std::max( v1.x, v2.x ) ) ), (float)mWidth - 1.0f );
+    float const bottom = std::max( std::floor( std::min( v0.y, std::min( v1.y, v2.y ) ) ), 0.0f );
+    float const top = std::min( std::ceil( std::max( v0.y, std::max( v1.y, v2.y ) ) ), (float)mHeight - 1.0f );
+    if (left > right || bottom > top)
+        return;
+
+    // Edge i is opposite vertex i: e( x, y ) = A x + B y + C. Depth is a plane in
+    // screen space, built from the same edge functions as barycentrics.
+    glm::vec3 const edgeA( v1.y - v2.y, v2.y - v0.y, v0.y - v1.y );
+    glm::vec3 const edgeB( v2.x - v1.x, v0.x - v2.x, v1.x - v0.x );
+    glm::vec3 const edgeC( v1.x * v2.y - v1.y * v2.x, v2.x * v0.y - v2.y * v0.x, v0.x * v1.y - v0.y * v1.x );
+    glm::vec3 const depths( v0.z, v1.z, v2.z );
+    float const depthA = glm::dot( edgeA, depths ) / area;
+    float const depthB = glm::dot( edgeB, depths ) / area;
+    float const depthC = glm::dot( edgeC, depths ) / area;
+
+    float* const depth = mLevels[0].mMax.data();
+    uint32_t const x0 = (uint32_t)left & ~3u;
+    uint32_t const x1 = (uint32_t)right;
+    for (uint32_t y = (uint32_t)bottom; y <= (uint32_t)top; y++)
+    {
+        float const py = (float)y + 0.5f;
+        float* const row = depth + y * mWidth;
+        uint32_t x = x0;
+#if defined(OCCLUSION_SSE)
+        __m128 const rowE0 = _mm_set1_ps( edgeB.x * py + edgeC.x );
+        __m128 const rowE1 = _mm_set1_ps( edgeB.y * py + edgeC.y );
+        __m128 const rowE2 = _mm_set1_ps( edgeB.z * py + edgeC.z );
+        __m128 const rowDepth = _mm_set1_ps( depthB * py + depthC );
+        __m128 const zero = _mm_setzero_ps();
+        for (; x <= x1; x += 4)
+        {
+            __m128 const px = _mm_add_ps( _mm_set1_ps( (float)x ), _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f ) );
+            __m128 const e0 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( edgeA.x ), px ), rowE0 );
+            __m128 const e1 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( edgeA.y ), px ), rowE1 );
+            __m128 const e2 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( edgeA.z ), px ), rowE2 );
+            __m128 const inside = _mm_and_ps( _mm_cmpge_ps( e0, zero ), _mm_and_ps( _mm_cmpge_ps( e1, zero ), _mm_cmpge_ps( e2, zero ) ) );
+            if (_mm_movemask_ps( inside ) == 0)
+                continue;
+            __m128 const current = _mm_loadu_ps( row + x );
+            __m128 const nearest = _mm_min_ps( current, _mm_add_ps( _mm_mul_ps( _mm_set1_ps( depthA ), px ), rowDepth ) );
+            _mm_storeu_ps( row + x, _mm_or_ps( _mm_and_ps( inside, nearest ), _mm_andnot_ps( inside, current ) ) );
+        }
+#endif
+        for (; x <= x1; x++)
+        {
+            float const px = (float)x + 0.5f;
+            glm::vec3 const e = edgeA * px + edgeB * py + edgeC;
+            if (e.x >= 0.0f && e.y >= 0.0f && e.z >= 0.0f)
+            {
+                row[x] = std::min( row[x], depthA * px + depthB * py + depthC );
+            }
+        }
+    }
+}
+
+//=============================================================================
+
+inline void OcclusionBuffer::End()
+{
+    // Each texel holds the min and max of the 2x2 below it; odd edges repeat their last texel.
+    for (uint32_t l = 1; l < (uint32_t)mLevels.size(); l++)
+    {
+        const Level& fine = mLevels[l - 1];
+        const std::vector<float>& fineMin = l == 1 ? fine.mMax : fine.mMin;
+        Level& coarse = mLevels[l];
+        for (uint32_t y = 0; y < coarse.mHeight; y++)
+        {
+            uint32_t const y0 = (y * 2) * fine.mWidth;
+            uint32_t const y1 = std::min( y * 2 + 1, fine.mHeight - 1 ) * fine.mWidth;
+            for (uint32_t x = 0; x < coarse.mWidth; x++)
+            {
+                uint32_t const x0 = x * 2;
+                uint32_t const x1 = std::min( x * 2 + 1, fine.mWidth - 1 );
+                uint32_t const texel = y * coarse.mWidth + x;
+                coarse.mMax[texel] = std::max( std::max( fine.mMax[y0 + x0], fine.mMax[y0 + x1] ), std::max( fine.mMax[y1 + x0], fine.mMax[y1 + x1] ) );
+                coarse.mMin[texel] = std::min( std::min( fineMin[y0 + x0], fineMin[y0 + x1] ), std::min( fineMin[y1 + x0], fineMin[y1 + x1] ) );
+            }
+        }
+    }
+}
+
+//=============================================================================
+
+inline bool OcclusionBuffer::IsVisible( const glm::vec3& min, const glm::vec3& max ) const
+{
+    // A box reaching behind the camera can't be placed on screen; call it visible.
+    glm::vec2 rectMin( (float)mWidth, (float)mHeight );
+    glm::vec2 rectMax( 0.0f );
+    float nearest = 1.0f;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        glm::vec3 const corner( (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z );
+        glm::vec4 const clip = mViewProjection * glm::vec4( corner, 1.0f );
+        if (clip.w <= 1e-4f || clip.z < -clip.w)
+            return true;
+        glm::vec3 const screen = ToScreen( clip );
+        rectMin = glm::min( rectMin, glm::vec2( screen ) );
+        rectMax = glm::max( rectMax, glm::vec2( screen ) );
+        nearest = std::min( nearest, screen.z );
+    }
+    if (rectMin.x >= (float)mWidth || rectMin.y >= (float)mHeight || rectMax.x <= 0.0f || rectMax.y <= 0.0f)
+        return true;
+    uint32_t const x0 = (uint32_t)std::max( rectMin.x, 0.0f );
+    uint32_t const y0 = (uint32_t)std::max( rectMin.y, 0.0f );
+    uint32_t const x1 = std::min( (uint32_t)rectMax.x, mWidth - 1 );
+    uint32_t const y1 = std::min( (uint32_t)rectMax.y, mHeight - 1 );
+
+    // Start where the rect is at most a few texels across.
+    uint32_t level = 0;
+    while (level + 1 < (uint32_t)mLevels.size() && ((x1 >> level) - (x0 >> level) + 1) * ((y1 >> level) - (y0 >> level) + 1) > 16)
+    {
+        level++;
+    }
+    for (;;)
+    {
+        const Level& texels = mLevels[level];
+        const std::vector<float>& levelMin = level == 0 ? texels.mMax : texels.mMin;
+        float farthest = 0.0f;
+        float closest = 1.0f;
+        for (uint32_t y = y0 >> level; y <= (y1 >> level); y++)
+        {
+            for (uint32_t x = x0 >> level; x <= (x1 >> level); x++)
+            {
+                farthest = std::max( farthest, texels.mMax[y * texels.mWidth + x] );
+                closest = std::min( closest, levelMin[y * texels.mWidth + x] );
+            }
+        }
+        if (nearest > farthest)
+            return false;
+        if (nearest <= closest || level == 0)
+            return true;
+        level--;
+        if (((x1 >> level) - (x0 >> level) + 1) * ((y1 >> level) - (y0 >> level) + 1) > MAX_TEST_TEXELS)
+            return true;
+    }
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <glad/glad.h>
+
+#include <glstate.h>
+
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+// Ring of hardware occlusion queries that never waits on the GPU. Each
+// query belongs to a caller's Id, e.g. a prop handle, and is usually a box
+// drawn with DrawBox after the scene, with color and depth writes off.
+//
+// Collect reads the answers in issue order and stops at the first one the
+// GPU hasn't got to, which stays in flight for the next call; in practice
+// answers arrive a frame or two later. Begin returns false while every
+// query is in flight, and the caller drops that query.
+//
+// GL 4.3 gets GL_ANY_SAMPLES_PASSED_CONSERVATIVE, which the GPU may answer
+// from its coarse depth; earlier versions use GL_ANY_SAMPLES_PASSED. Owned
+// by the thread with the GL context, like GetGLState().
+//=============================================================================
+
+template<typename Id>
+class OcclusionQueries
+{
+public:
+    OcclusionQueries(): mFirst( 0 ), mCount( 0 ), mTarget( GL_ANY_SAMPLES_PASSED ), mBoxArray( 0 ), mBoxVertices( 0 ), mBoxIndices( 0 ) {}
+    ~OcclusionQueries();
+    OcclusionQueries( const OcclusionQueries& ) = delete;
+    OcclusionQueries& operator=( const OcclusionQueries& ) = delete;
+
+    void Create( uint32_t const capacity );
+
+    // Calls fn( id, anySamplesPassed ) for every finished query, oldest first.
+    template<typename Fn>
+    void Collect( const Fn& fn );
+
+    bool Begin( Id const id );
+    void End() { glEndQuery( mTarget ); }
+
+    // Unit cube [0, 1]^3 at attribute 0, to be stretched over a box by the vertex shader.
+    void BindBox() const { GetGLState().BindVertexArray( mBoxArray ); }
+    void DrawBox() const { glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr ); }
+
+    uint32_t GetPending() const { return mCount; }
+
+private:
+    std::vector<GLuint> mQueries;
+    std::vector<Id> mIds;       // owner of each query while it is in flight
+    uint32_t mFirst;            // oldest query in flight
+    uint32_t mCount;            // queries in flight
+    GLenum mTarget;
+    GLuint mBoxArray;
+    GLuint mBoxVertices;
+    GLuint mBoxIndices;
+};
+
+//=============================================================================
+
+template<typename Id>
+OcclusionQueries<Id>::~OcclusionQueries()
+{
+    if (mBoxArray != 0)
+    {
+        glDeleteQueries( (GLsizei)mQueries.size(), mQueries.data() );
+        glDeleteVertexArrays( 1, &mBoxArray );
+        glDeleteBuffers( 1, &mBoxVertices );
+        glDeleteBuffers( 1, &mBoxIndices );
+    }
+}
+
+//=============================================================================
+
+template<typename Id>
+void OcclusionQueries<Id>::Create( uint32_t const capacity )
+{
+    mQueries.resize( capacity );
+    mIds.resize( capacity );
+    glGenQueries( (GLsizei)capacity, mQueries.data() );
+    mTarget = GLAD_GL_VERSION_4_3 ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+
+    // Corner i has x in bit 0, y in bit 1 and z in bit 2.
+    static GLfloat const corners[24] =
+    {
+        0.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 1.0f,   1.0f, 0.0f, 1.0f,   0.0f, 1.0f, 1.0f,   1.0f, 1.0f, 1.0f,
+    };
+    static GLubyte const indices[36] =
+    {
+        0, 2, 3, 0, 3, 1,   4, 5, 7, 4, 7, 6,   0, 1, 5, 0, 5, 4,
+        2, 6, 7, 2, 7, 3,   0, 4, 6, 0, 6, 2,   1, 3, 7, 1, 7, 5,
+    };
+    glGenVertexArrays( 1, &mBoxArray );
+    glGenBuffers( 1, &mBoxVertices );
+    glGenBuffers( 1, &mBoxIndices );
+    BindBox();
+    glBindBuffer( GL_ARRAY_BUFFER, mBoxVertices );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( corners ), corners, GL_STATIC_DRAW );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mBoxIndices );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( indices ), indices, GL_STATIC_DRAW );
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof( GLfloat ), (void*)0 );
+    GetGLState().BindVertexArray( 0 );
+}
+
+//=============================================================================
+
+template<typename Id>
+template<typename Fn>
+void OcclusionQueries<Id>::Collect( const Fn& fn )
+{
+    uint32_t const capacity = (uint32_t)mQueries.size();
+    while (mCount > 0)
+    {
+        GLuint const query = mQueries[mFirst];
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv( query, GL_QUERY_RESULT_AVAILABLE, &available );
+        if (available == GL_FALSE)
+            break;
+        GLuint passed = GL_FALSE;
+        glGetQueryObjectuiv( query, GL_QUERY_RESULT, &passed );
+        fn( mIds[mFirst], passed != GL_FALSE );
+        mFirst = (mFirst + 1) % capacity;
+        mCount--;
+    }
+}
+
+//=============================================================================
+
+template<typename Id>
+bool OcclusionQueries<Id>::Begin( Id const id )
+{
+    uint32_t const capacity = (uint32_t)mQueries.size();
+    if (mCount == capacity)
+        return false;
+    uint32_t const slot = (mFirst + mCount) % capacity;
+    mIds[slot] = id;
+    mCount++;
+    glBeginQuery( mTarget, mQueries[slot] );
+    return true;
+}
+
+//=============================================================================
+
+#endif
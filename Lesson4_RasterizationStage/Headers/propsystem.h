@@ -0,0 +1,983 @@
+#ifndef PROP_SYSTEM_H
+#define PROP_SYSTEM_H
+
+#include <aabbtree.h>
+#include <frustum.h>
+#include <jobsystem.h>
+#include <objectpool.h>
+#include <occlusion.h>
+#include <spatialgrid.h>
+#include <transformbatch.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PROP_SYSTEM_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PROP_SYSTEM_SSE
+#endif
+
+//=============================================================================
+// Data oriented prop simulation. Every field lives in its own contiguous
+// array so integration and wall bounce run as SIMD kernels; only the
+// prop-vs-prop collision pass is scalar.
+//
+// Each pass only writes the props of its own range and only reads other
+// props' start of tick state, so any split over threads gives bit identical
+// results.
+//
+// Simulation LOD: props near the camera and on screen step every tick. Far
+// props step every mLodFarInterval ticks and off-screen ones every
+// mLodHiddenInterval ticks, catching up with the time they skipped. At most
+// mLodBudget of those reduced rate props step per tick; the rest wait.
+//
+// Every prop also has a leaf in an AabbTree, boxing it at any heading over
+// the last tick, moved after each tick and rebuilt every
+// mTreeRebuildInterval ticks. Visibility, light radius and ray queries walk
+// the tree instead of every prop.
+//
+// For instanced drawing BuildInstances packs each prop into one vec4 instead
+// of a model and normal matrix and flags whether it is inside the view: the
+// tree query settles most props by their subtree, and only those whose box
+// crosses a plane get the exact test of their model's bounding sphere, a
+// block at a time with Frustum::CullSpheres. It then counts the visible ones
+// per model and chunk. Given an OcclusionBuffer, visible props are also
+// tested against it; DrawOccluders puts the props nearest the camera into it
+// first, each as its model's occluder box placed by a matrix from
+// BuildTransformBatch, see transformbatch.h. Without a frustum every prop
+// counts as inside the view, for culling on the GPU.
+//
+// With mQueryInterval set, hardware occlusion query answers hide props too.
+// BuildInstances lists the props due a query: the hidden ones every frame,
+// so they come back as soon as they show, and the rest every mQueryInterval
+// frames, staggered by index, at most mQueryBudget a frame. Answers come back
+// by handle through SetQueryResult, a frame or more later; a prop leaving the
+// view or occluded on the CPU forgets its answer. WriteInstances then scatters
+// them grouped by model, each chunk into its own precomputed range, so both
+// passes run in parallel and the output order never depends on threads.
+//
+// Props are referred to by generational handles. Remove swaps the last prop
+// into the hole, so the arrays stay packed and a handle maps to the prop's
+// current array index through a slot pool.
+//=============================================================================
+
+struct PropSlot
+{
+    uint32_t mIndex;    // index into the per prop arrays
+};
+
+typedef ObjectPool<PropSlot>::Handle PropHandle;
+
+//=============================================================================
+
+struct PropSystem
+{
+    PropSystem( float const halfExtent, float const collisionDist );
+
+    PropHandle Add( const glm::vec2& posXZ, const glm::vec2& velocityXZ, float const scale, uint32_t const modelIndex );
+    void Remove( PropHandle const handle );
+    uint32_t GetIndex( PropHandle const handle ) const;     // ~0u for a stale handle
+    PropHandle GetHandle( uint32_t const index ) const { return mHandle[index]; }
+
+    // Adds count props in one go. init( n, posXZ, velocityXZ, scale, modelIndex )
+    // fills in prop n of the batch and is called in parallel, so it must only
+    // depend on n. Returns the array index of the first new prop.
+    template<typename InitFn>
+    uint32_t Spawn( uint32_t const count, JobSystem& jobs, const InitFn& init );
+    void Reserve( uint32_t const count );
+    void SetLodView( const glm::vec3& cameraPos, const glm::mat4& viewProjection );
+    // Model space bounding sphere of a prop model, for BuildInstances' view test.
+    void SetModelBounds( uint32_t const modelIndex, const glm::vec3& center, float const radius );
+    // Model space box inside a prop model's geometry, drawn by DrawOccluders; models without one aren't drawn.
+    void SetModelOccluder( uint32_t const modelIndex, const glm::vec3& min, const glm::vec3& max );
+    void Update( float const tickTime, JobSystem& jobs );
+    // Draws the occluder boxes of the up to maxCount props nearest the camera within maxDist.
+    void DrawOccluders( OcclusionBuffer& buffer, const glm::vec3& cameraPos, float const interpolation, float const maxDist, uint32_t const maxCount );
+    // frustum may be nullptr, and then every prop is in the view. occlusion may be nullptr; otherwise
+    // it must be ended, and props behind its occluders count as hidden.
+    void BuildInstances( float const interpolation, const Frustum* frustum, const OcclusionBuffer* occlusion, uint32_t const numModels, JobSystem& jobs );
+    void WriteInstances( glm::vec4* out, JobSystem& jobs );
+    // Start of model m's visible instances in WriteInstances' output; m == numModels gives the total.
+    uint32_t GetInstanceFirst( uint32_t const model ) const { return mInstanceFirst[model]; }
+    // Props in the view that the last BuildInstances found occluded, by the buffer or by a query.
+    uint32_t GetOccludedCount() const { return mOccludedCount; }
+    // Props the last BuildInstances wants an occlusion query for, by array index.
+    uint32_t GetQueryCount() const { return (uint32_t)mQueryProps.size(); }
+    uint32_t GetQueryProp( uint32_t const n ) const { return mQueryProps[n]; }
+    // A query's answer for a prop; stale handles are ignored.
+    void SetQueryResult( PropHandle const handle, bool const visible );
+    // World box around a prop at its last BuildInstances position, at any heading.
+    void GetInstanceBox( uint32_t const index, glm::vec3& min, glm::vec3& max ) const;
+    // Calls fn( index ) for every prop whose box touches the sphere, e.g. a light's radius.
+    template<typename Fn>
+    void QuerySphere( const glm::vec3& center, float const radius, const Fn& fn ) const { mTree.QuerySphere( center, radius, fn ); }
+    // Index of the nearest prop whose bounding sphere the ray hits within maxDist, ~0u for none.
+    uint32_t RayCast( const glm::vec3& origin, const glm::vec3& direction, float const maxDist ) const;
+    uint32_t GetCount() const { return (uint32_t)mPosXZ.size(); }
+
+    // Per prop state.
+    std::vector<glm::vec2> mPosXZ;
+    std::vector<glm::vec2> mPrevPosXZ;    // mPosXZ before the last tick
+    std::vector<glm::vec2> mVelocityXZ;
+    std::vector<float> mScale;
+    std::vector<float> mOverrideDist;
+    std::vector<uint32_t> mModelIndex;
+    std::vector<glm::vec4> mInstance;     // x, z, heading in radians, scale
+    std::vector<uint8_t> mVisible;        // set by BuildInstances
+    std::vector<uint8_t> mQueryHidden;    // the last query answer said hidden
+
+    float mSpeed;   // meters per second
+    float mHalfExtent;
+    float mCollisionDist;
+
+    // Simulation LOD settings.
+    float mLodNearDist;         // full rate inside this distance from the camera
+    float mLodBoundRadius;      // sphere around a prop used for the on screen test
+    float mLodMaxPendingTime;   // skipped time beyond this, or beyond a step of mCollisionDist, is dropped, not caught up
+    uint32_t mLodFarInterval;
+    uint32_t mLodHiddenInterval;
+    uint32_t mLodBudget;        // reduced rate props stepped per tick
+    uint32_t mLastStepCount;    // props stepped by the last tick
+
+    uint32_t mTreeRebuildInterval;  // ticks between SAH rebuilds of the tree, 0 for never
+    uint32_t mQueryInterval;        // frames between queries of a visible prop, 0 for no queries
+    uint32_t mQueryBudget;          // queries asked for per frame at most
+
+private:
+    // Props per job, a multiple of the SIMD width.
+    static uint32_t const GRAIN = 1024;
+    // Props per frustum test batch in BuildInstances, a multiple of the SIMD width.
+    static uint32_t const CULL_BLOCK = 64;
+
+    enum : uint8_t
+    {
+        LOD_NEAR,
+        LOD_FAR,
+        LOD_HIDDEN,
+    };
+
+    // mVisible while BuildInstances runs; it ends up 0 or 1.
+    enum : uint8_t
+    {
+        CULL_OUTSIDE,
+        CULL_INSIDE,
+        CULL_TEST,
+    };
+
+    struct OccluderBox
+    {
+        glm::vec3 mMin;
+        glm::vec3 mMax;     // below mMin for models without an occluder
+    };
+
+    glm::vec4 GetModelSphere( uint32_t const modelIndex ) const;
+    void GetTreeBox( uint32_t const index, glm::vec3& min, glm::vec3& max ) const;
+    void UpdateTree();
+
+    void ClassifyLod( uint32_t const begin, uint32_t const end );
+    void Schedule( float const tickTime );
+    void Integrate( uint32_t const begin, uint32_t const end );
+    void Collide( uint32_t const begin, uint32_t const end );
+    // One GRAIN sized chunk of props each; the chunk picks its row of mChunkInstances.
+    void BuildInstanceChunk( uint32_t const chunk, float const interpolation, const Frustum* frustum, const OcclusionBuffer* occlusion );
+    void WriteInstanceChunk( uint32_t const chunk, glm::vec4* out );
+
+    // Per tick scratch; mNewPosXZ becomes mPosXZ once collision has resolved.
+    std::vector<glm::vec2> mNewPosXZ;
+    std::vector<uint8_t> mHitWall;
+    std::vector<uint8_t> mLod;
+    std::vector<float> mStepDist;       // how far each prop moves this tick, 0 if skipped
+    std::vector<float> mPendingTime;    // time since the prop last stepped
+    std::vector<PropHandle> mHandle;    // owner of each array index
+    std::vector<uint32_t> mChunkInstances;  // per chunk and model: visible count, then write offset
+    std::vector<uint32_t> mInstanceFirst;   // per model, plus the total
+    std::vector<uint32_t> mChunkOccluded;   // per chunk
+    std::vector<uint32_t> mOccluders;       // DrawOccluders' candidates
+    std::vector<glm::vec2> mOccluderPosXZ;  // the nearest ones gathered for BuildTransformBatch
+    std::vector<glm::vec2> mOccluderPrevPosXZ;
+    std::vector<glm::vec2> mOccluderVelocityXZ;
+    std::vector<float> mOccluderScale;
+    std::vector<glm::mat4> mOccluderTransform;
+    std::vector<uint8_t> mQueryDue;         // per prop, set by BuildInstances
+    std::vector<uint32_t> mQueryProps;
+    std::vector<OccluderBox> mModelOccluders;
+    std::vector<glm::vec4> mModelSpheres;   // per model: center xyz, radius
+    std::vector<int32_t> mTreeLeaf;         // per prop
+    AabbTree mTree;                         // leaf user data is the prop's array index
+    uint32_t mInstanceModels;
+    uint32_t mOccludedCount;
+    uint32_t mQueryFrame;       // BuildInstances calls so far
+    uint32_t mQueryCursor;      // where the budget starts among the due props
+    ObjectPool<PropSlot> mSlots;
+    SpatialGrid mGrid;
+
+    glm::vec3 mCameraPos;
+    Frustum mFrustum;
+    uint32_t mTick;
+    uint32_t mLodCursor;
+};
+
+//=============================================================================
+
+inline PropSystem::PropSystem( float const halfExtent, float const collisionDist ):
+    mSpeed( 2.5f ),
+    mHalfExtent( halfExtent ),
+    mCollisionDist( collisionDist ),
+    mLodNearDist( 25.0f ),
+    mLodBoundRadius( 2.0f ),
+    mLodMaxPendingTime( 0.5f ),
+    mLodFarInterval( 4 ),
+    mLodHiddenInterval( 8 ),
+    mLodBudget( 16384 ),
+    mLastStepCount( 0 ),
+    mTreeRebuildInterval( 120 ),
+    mQueryInterval( 0 ),
+    mQueryBudget( 1024 ),
+    mTree( 0.5f ),
+    mInstanceModels( 0 ),
+    mOccludedCount( 0 ),
+    mQueryFrame( 0 ),
+    mQueryCursor( 0 ),
+    mGrid( collisionDist, halfExtent ),
+    mCameraPos( 0.0f ),
+    mFrustum( glm::mat4( 1.0f ) ),
+    mTick( 0 ),
+    mLodCursor( 0 )
+{
+}
+
+//=============================================================================
+
+inline PropHandle PropSystem::Add( const glm::vec2& posXZ, const glm::vec2& velocityXZ, float const scale, uint32_t const modelIndex )
+{
+    PropHandle const handle = mSlots.Create( PropSlot{ GetCount() } );
+    mPosXZ.push_back( posXZ );
+    mPrevPosXZ.push_back( posXZ );
+    mVelocityXZ.push_back( velocityXZ );
+    mScale.push_back( scale );
+    mOverrideDist.push_back( 0.0f );
+    mModelIndex.push_back( modelIndex );
+    mInstance.push_back( glm::vec4( 0.0f ) );
+    mVisible.push_back( 0 );
+    mQueryHidden.push_back( 0 );
+    mNewPosXZ.push_back( posXZ );
+    mHitWall.push_back( 0 );
+    mLod.push_back( LOD_NEAR );
+    mStepDist.push_back( 0.0f );
+    mPendingTime.push_back( 0.0f );
+    mHandle.push_back( handle );
+
+    glm::vec3 min;
+    glm::vec3 max;
+    GetTreeBox( GetCount() - 1, min, max );
+    mTreeLeaf.push_back( mTree.Insert( min, max, GetCount() - 1 ) );
+    return handle;
+}
+
+//=============================================================================
+
+template<typename InitFn>
+uint32_t PropSystem::Spawn( uint32_t const count, JobSystem& jobs, const InitFn& init )
+{
+    // Growing the arrays and handing out handles is serial, filling them isn't.
+    uint32_t const first = GetCount();
+    uint32_t const total = first + count;
+    mPosXZ.resize( total );
+    mPrevPosXZ.resize( total );
+    mVelocityXZ.resize( total );
+    mScale.resize( total );
+    mOverrideDist.resize( total, 0.0f );
+    mModelIndex.resize( total );
+    mInstance.resize( total, glm::vec4( 0.0f ) );
+    mVisible.resize( total, 0 );
+    mQueryHidden.resize( total, 0 );
+    mNewPosXZ.resize( total );
+    mHitWall.resize( total, 0 );
+    mLod.resize( total, LOD_NEAR );
+    mStepDist.resize( total, 0.0f );
+    mPendingTime.resize( total, 0.0f );
+    mHandle.reserve( total );
+    for (uint32_t i = first; i < total; i++)
+    {
+        mHandle.push_back( mSlots.Create( PropSlot{ i } ) );
+    }
+
+    jobs.ParallelFor( first, total, GRAIN, [this, first, &init]( uint32_t const begin, uint32_t const end )
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            init( i - first, mPosXZ[i], mVelocityXZ[i], mScale[i], mModelIndex[i] );
+            mPrevPosXZ[i] = mPosXZ[i];
+            mNewPosXZ[i] = mPosXZ[i];
+        }
+    } );
+
+    // A batch goes into the tree leaf by leaf, then gets a proper SAH build.
+    mTreeLeaf.reserve( total );
+    for (uint32_t i = first; i < total; i++)
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        GetTreeBox( i, min, max );
+        mTreeLeaf.push_back( mTree.Insert( min, max, i ) );
+    }
+    mTree.Rebuild();
+    return first;
+}
+
+//=============================================================================
+
+inline void PropSystem::Remove( PropHandle const handle )
+{
+    PropSlot* const slot = mSlots.Get( handle );
+    if (slot == nullptr)
+        return;
+
+    // Move the last prop into the hole and repoint its handle.
+    uint32_t const index = slot->mIndex;
+    uint32_t const last = GetCount() - 1;
+    mTree.Remove( mTreeLeaf[index] );
+    if (index != last)
+    {
+        mPosXZ[index] = mPosXZ[last];
+        mPrevPosXZ[index] = mPrevPosXZ[last];
+        mVelocityXZ[index] = mVelocityXZ[last];
+        mScale[index] = mScale[last];
+        mOverrideDist[index] = mOverrideDist[last];
+        mModelIndex[index] = mModelIndex[last];
+        mInstance[index] = mInstance[last];
+        mVisible[index] = mVisible[last];
+        mQueryHidden[index] = mQueryHidden[last];
+        mNewPosXZ[index] = mNewPosXZ[last];
+        mHitWall[index] = mHitWall[last];
+        mLod[index] = mLod[last];
+        mStepDist[index] = mStepDist[last];
+        mPendingTime[index] = mPendingTime[last];
+        mHandle[index] = mHandle[last];
+        mSlots.Get( mHandle[index] )->mIndex = index;
+        mTreeLeaf[index] = mTreeLeaf[last];
+        mTree.SetUserData( mTreeLeaf[index], index );
+    }
+
+    // pop_back keeps the capacity, so removing and re-adding never reallocates.
+    mPosXZ.pop_back();
+    mPrevPosXZ.pop_back();
+    mVelocityXZ.pop_back();
+    mScale.pop_back();
+    mOverrideDist.pop_back();
+    mModelIndex.pop_back();
+    mInstance.pop_back();
+    mVisible.pop_back();
+    mQueryHidden.pop_back();
+    mNewPosXZ.pop_back();
+    mHitWall.pop_back();
+    mLod.pop_back();
+    mStepDist.pop_back();
+    mPendingTime.pop_back();
+    mHandle.pop_back();
+    mTreeLeaf.pop_back();
+    mSlots.Destroy( handle );
+}
+
+//=============================================================================
+
+inline uint32_t PropSystem::GetIndex( PropHandle const handle ) const
+{
+    const PropSlot* const slot = mSlots.Get( handle );
+    return slot != nullptr ? slot->mIndex : ~0u;
+}
+
+//=============================================================================
+
+inline void PropSystem::Reserve( uint32_t const count )
+{
+    mPosXZ.reserve( count );
+    mPrevPosXZ.reserve( count );
+    mVelocityXZ.reserve( count );
+    mScale.reserve( count );
+    mOverrideDist.reserve( count );
+    mModelIndex.reserve( count );
+    mInstance.reserve( count );
+    mVisible.reserve( count );
+    mQueryHidden.reserve( count );
+    mQueryDue.reserve( count );
+    mNewPosXZ.reserve( count );
+    mHitWall.reserve( count );
+    mLod.reserve( count );
+    mStepDist.reserve( count );
+    mPendingTime.reserve( count );
+    mHandle.reserve( count );
+    mTreeLeaf.reserve( count );
+    mSlots.Reserve( count );
+}
+
+//=============================================================================
+
+inline void PropSystem::SetLodView( const glm::vec3& cameraPos, const glm::mat4& viewProjection )
+{
+    mCameraPos = cameraPos;
+    mFrustum = Frustum( viewProjection );
+}
+
+//=============================================================================
+
+inline void PropSystem::Update( float const tickTime, JobSystem& jobs )
+{
+    uint32_t const count = GetCount();
+    if (count == 0)
+        return;
+
+    jobs.ParallelFor( 0, count, GRAIN, [this]( uint32_t const begin, uint32_t const end ) { ClassifyLod( begin, end ); } );
+    Schedule( tickTime );
+    mTick++;
+
+    mGrid.Build( count, [this]( uint32_t const i ) { return mPosXZ[i]; } );
+    jobs.ParallelFor( 0, count, GRAIN, [this]( uint32_t const begin, uint32_t const end ) { Integrate( begin, end ); } );
+    jobs.ParallelFor( 0, count, GRAIN, [this]( uint32_t const begin, uint32_t const end ) { Collide( begin, end ); } );
+
+    // Resolved candidates become current, start of tick positions become previous.
+    mPosXZ.swap( mNewPosXZ );
+    mPrevPosXZ.swap( mNewPosXZ );
+    UpdateTree();
+}
+
+//=============================================================================
+
+inline void PropSystem::UpdateTree()
+{
+    // Most props are still inside their fat boxes and cost one compare.
+    for (uint32_t i = 0; i < GetCount(); i++)
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        GetTreeBox( i, min, max );
+        mTree.Move( mTreeLeaf[i], min, max );
+    }
+    if (mTreeRebuildInterval != 0 && mTick % mTreeRebuildInterval == 0)
+    {
+        mTree.Rebuild();
+    }
+}
+
+//=============================================================================
+
+inline glm::vec4 PropSystem::GetModelSphere( uint32_t const modelIndex ) const
+{
+    // Models without bounds get the LOD test's sphere.
+    return modelIndex < mModelSpheres.size() ? mModelSpheres[modelIndex] : glm::vec4( 0.0f, mLodBoundRadius * 0.5f, 0.0f, mLodBoundRadius );
+}
+
+//=============================================================================
+
+inline void PropSystem::GetTreeBox( uint32_t const index, glm::vec3& min, glm::vec3& max ) const
+{
+    // The model's sphere at any heading, anywhere between the previous and the current
+    // position, so every interpolated frame of the last tick stays inside.
+    glm::vec4 const sphere = GetModelSphere( mModelIndex[index] );
+    float const scale = mScale[index];
+    float const reach = (glm::length( glm::vec2( sphere.x, sphere.z ) ) + sphere.w) * scale;
+    glm::vec2 const lo = glm::min( mPosXZ[index], mPrevPosXZ[index] ) - reach;
+    glm::vec2 const hi = glm::max( mPosXZ[index], mPrevPosXZ[index] ) + reach;
+    min = glm::vec3( lo.x, (sphere.y - sphere.w) * scale, lo.y );
+    max = glm::vec3( hi.x, (sphere.y + sphere.w) * scale, hi.y );
+}
+
+//=============================================================================
+
+inline void PropSystem::GetInstanceBox( uint32_t const index, glm::vec3& min, glm::vec3& max ) const
+{
+    glm::vec4 const sphere = GetModelSphere( mModelIndex[index] );
+    float const scale = mScale[index];
+    float const reach = (glm::length( glm::vec2( sphere.x, sphere.z ) ) + sphere.w) * scale;
+    min = glm::vec3( mInstance[index].x - reach, (sphere.y - sphere.w) * scale, mInstance[index].y - reach );
+    max = glm::vec3( mInstance[index].x + reach, (sphere.y + sphere.w) * scale, mInstance[index].y + reach );
+}
+
+//=============================================================================
+
+inline void PropSystem::SetQueryResult( PropHandle const handle, bool const visible )
+{
+    uint32_t const index = GetIndex( handle );
+    if (index != ~0u)
+    {
+        mQueryHidden[index] = visible ? 0 : 1;
+    }
+}
+
+//=============================================================================
+
+inline uint32_t PropSystem::RayCast( const glm::vec3& origin, const glm::vec3& direction, float const maxDist ) const
+{
+    // Exact test against the heading independent sphere the tree box is built from.
+    glm::vec3 const dir = glm::normalize( direction );
+    uint32_t nearest = ~0u;
+    mTree.QueryRay( origin, dir, maxDist, [&]( uint32_t const index, float const dist )
+    {
+        glm::vec4 const sphere = GetModelSphere( mModelIndex[index] );
+        float const scale = mScale[index];
+        float const radius = (glm::length( glm::vec2( sphere.x, sphere.z ) ) + sphere.w) * scale;
+        glm::vec3 const toCenter = glm::vec3( mPosXZ[index].x, sphere.y * scale, mPosXZ[index].y ) - origin;
+        float const along = glm::dot( toCenter, dir );
+        float const missSq = glm::dot( toCenter, toCenter ) - along * along;
+        if (missSq > radius * radius)
+            return dist;
+        float const hit = along - std::sqrt( radius * radius - missSq );
+        if (hit < 0.0f || hit >= dist)
+            return dist;
+        nearest = index;
+        return hit;
+    } );
+    return nearest;
+}
+
+//=============================================================================
+
+inline void PropSystem::SetModelBounds( uint32_t const modelIndex, const glm::vec3& center, float const radius )
+{
+    // Tree boxes catch up with the new size as the props move.
+    while (mModelSpheres.size() <= modelIndex)
+    {
+        mModelSpheres.push_back( GetModelSphere( (uint32_t)mModelSpheres.size() ) );
+    }
+    mModelSpheres[modelIndex] = glm::vec4( center, radius );
+}
+
+//=============================================================================
+
+inline void PropSystem::SetModelOccluder( uint32_t const modelIndex, const glm::vec3& min, const glm::vec3& max )
+{
+    while (mModelOccluders.size() <= modelIndex)
+    {
+        mModelOccluders.push_back( OccluderBox{ glm::vec3( 0.0f ), glm::vec3( -1.0f ) } );
+    }
+    mModelOccluders[modelIndex] = OccluderBox{ min, max };
+}
+
+//=============================================================================
+
+inline void PropSystem::DrawOccluders( OcclusionBuffer& buffer, const glm::vec3& cameraPos, float const interpolation, float const maxDist, uint32_t const maxCount )
+{
+    // Near props cover the most screen; the tree finds the candidates, the nearest few get drawn.
+    mOccluders.clear();
+    mTree.QuerySphere( cameraPos, maxDist, [this]( uint32_t const index )
+    {
+        uint32_t const model = mModelIndex[index];
+        if (model < mModelOccluders.size() && mModelOccluders[model].mMin.x <= mModelOccluders[model].mMax.x)
+        {
+            mOccluders.push_back( index );
+        }
+    } );
+    glm::vec2 const cameraXZ( cameraPos.x, cameraPos.z );
+    auto const nearer = [this, &cameraXZ]( uint32_t const a, uint32_t const b )
+    {
+        glm::vec2 const toA = mPosXZ[a] - cameraXZ;
+        glm::vec2 const toB = mPosXZ[b] - cameraXZ;
+        return glm::dot( toA, toA ) < glm::dot( toB, toB );
+    };
+    if (mOccluders.size() > maxCount)
+    {
+        std::nth_element( mOccluders.begin(), mOccluders.begin() + maxCount, mOccluders.end(), nearer );
+        mOccluders.resize( maxCount );
+    }
+
+    // Placed like the instance: interpolated position, heading from the velocity, as in shaders/model.vs.
+    // Gathered into packed arrays, the matrices come out of one batch.
+    uint32_t const count = (uint32_t)mOccluders.size();
+    mOccluderPosXZ.resize( count );
+    mOccluderPrevPosXZ.resize( count );
+    mOccluderVelocityXZ.resize( count );
+    mOccluderScale.resize( count );
+    mOccluderTransform.resize( count );
+    for (uint32_t n = 0; n < count; n++)
+    {
+        uint32_t const i = mOccluders[n];
+        mOccluderPosXZ[n] = mPosXZ[i];
+        mOccluderPrevPosXZ[n] = mPrevPosXZ[i];
+        mOccluderVelocityXZ[n] = mVelocityXZ[i];
+        mOccluderScale[n] = mScale[i];
+    }
+    if (count > 0)
+    {
+        BuildTransformBatch( mOccluderPosXZ.data(), mOccluderPrevPosXZ.data(), interpolation, mOccluderVelocityXZ.data(), mOccluderScale.data(),
+                             count, mOccluderTransform.data(), nullptr );
+    }
+    for (uint32_t n = 0; n < count; n++)
+    {
+        const OccluderBox& box = mModelOccluders[mModelIndex[mOccluders[n]]];
+        buffer.DrawBox( mOccluderTransform[n], box.mMin, box.mMax );
+    }
+}
+
+//=============================================================================
+
+inline void PropSystem::BuildInstances( float const interpolation, const Frustum* frustum, const OcclusionBuffer* occlusion, uint32_t const numModels, JobSystem& jobs )
+{
+    uint32_t const numChunks = (GetCount() + GRAIN - 1) / GRAIN;
+    mInstanceModels = numModels;
+    mChunkInstances.resize( numChunks * numModels );
+    mChunkOccluded.resize( numChunks );
+    mQueryDue.resize( GetCount() );
+
+    // The tree sorts the props into outside, inside and crossing the view.
+    if (GetCount() > 0)
+    {
+        memset( mVisible.data(), frustum != nullptr ? CULL_OUTSIDE : CULL_INSIDE, GetCount() );
+    }
+    if (frustum != nullptr)
+    {
+        mTree.QueryFrustum( *frustum, [this]( uint32_t const index, bool const inside ) { mVisible[index] = inside ? CULL_INSIDE : CULL_TEST; } );
+    }
+    jobs.ParallelFor( 0, GetCount(), GRAIN, [this, interpolation, frustum, occlusion]( uint32_t const begin, uint32_t const end )
+    {
+        for (uint32_t chunk = begin / GRAIN; chunk * GRAIN < end; chunk++)
+        {
+            BuildInstanceChunk( chunk, interpolation, frustum, occlusion );
+        }
+    } );
+    mOccludedCount = 0;
+    for (uint32_t c = 0; c < numChunks; c++)
+    {
+        mOccludedCount += mChunkOccluded[c];
+    }
+
+    // Over budget, the due props take turns from a cursor that moves on every frame.
+    mQueryProps.clear();
+    if (mQueryInterval != 0)
+    {
+        for (uint32_t i = 0; i < GetCount(); i++)
+        {
+            if (mQueryDue[i])
+            {
+                mQueryProps.push_back( i );
+            }
+        }
+        if (mQueryProps.size() > mQueryBudget)
+        {
+            std::rotate( mQueryProps.begin(), mQueryProps.begin() + mQueryCursor % mQueryProps.size(), mQueryProps.end() );
+            mQueryProps.resize( mQueryBudget );
+            mQueryCursor += mQueryBudget;
+        }
+    }
+    mQueryFrame++;
+
+    // Turn the counts into write offsets: models one after another, and
+    // within a model the chunks in prop order.
+    mInstanceFirst.resize( numModels + 1 );
+    uint32_t total = 0;
+    for (uint32_t m = 0; m < numModels; m++)
+    {
+        mInstanceFirst[m] = total;
+        for (uint32_t c = 0; c < numChunks; c++)
+        {
+            uint32_t const count = mChunkInstances[c * numModels + m];
+            mChunkInstances[c * numModels + m] = total;
+            total += count;
+        }
+    }
+    mInstanceFirst[numModels] = total;
+}
+
+//=============================================================================
+
+inline void PropSystem::WriteInstances( glm::vec4* out, JobSystem& jobs )
+{
+    // Chunk c writes the range BuildInstances counted for chunk c.
+    jobs.ParallelFor( 0, GetCount(), GRAIN, [this, out]( uint32_t const begin, uint32_t const end )
+    {
+        for (uint32_t chunk = begin / GRAIN; chunk * GRAIN < end; chunk++)
+        {
+            WriteInstanceChunk( chunk, out );
+        }
+    } );
+}
+
+//=============================================================================
+
+inline void PropSystem::ClassifyLod( uint32_t const begin, uint32_t const end )
+{
+    float const nearDistSq = mLodNearDist * mLodNearDist;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        glm::vec3 const center( mPosXZ[i].x, mLodBoundRadius * 0.5f, mPosXZ[i].y );
+        glm::vec3 const toCamera = center - mCameraPos;
+        if (!mFrustum.IntersectsSphere( center, mLodBoundRadius ))
+        {
+            mLod[i] = LOD_HIDDEN;
+        }
+        else
+        {
+            mLod[i] = glm::dot( toCamera, toCamera ) < nearDistSq ? LOD_NEAR : LOD_FAR;
+        }
+    }
+}
+
+//=============================================================================
+
+inline void PropSystem::Schedule( float const tickTime )
+{
+    // Reduced rate props are spread over their interval by index. The budget is
+    // handed out from a cursor that moves on every tick so nobody starves.
+    // A catch up step never moves further than the collision distance, so
+    // it can't jump over another prop the collision test would have hit.
+    float const maxPending = glm::min( mLodMaxPendingTime, mCollisionDist / mSpeed );
+    uint32_t const count = GetCount();
+    uint32_t budget = mLodBudget;
+    uint32_t stepped = 0;
+    for (uint32_t n = 0; n < count; n++)
+    {
+        uint32_t const i = (mLodCursor + n) % count;
+        float const pending = glm::min( mPendingTime[i] + tickTime, maxPending );
+        bool step = mLod[i] == LOD_NEAR;
+        if (!step)
+        {
+            uint32_t const interval = mLod[i] == LOD_FAR ? mLodFarInterval : mLodHiddenInterval;
+            bool const due = ((mTick + i) % interval) == 0 || pending >= maxPending;
+            if (due && budget > 0)
+            {
+                step = true;
+                budget--;
+            }
+        }
+
+        if (step)
+        {
+            mStepDist[i] = pending * mSpeed;
+            mPendingTime[i] = 0.0f;
+            stepped++;
+        }
+        else
+        {
+            mStepDist[i] = 0.0f;
+            mPendingTime[i] = pending;
+        }
+    }
+    mLodCursor = count > 0 ? (mLodCursor + mLodBudget) % count : 0;
+    mLastStepCount = stepped;
+}
+
+//=============================================================================
+
+inline void PropSystem::Integrate( uint32_t const begin, uint32_t const end )
+{
+    // Candidate position, override countdown and wall test for every prop.
+    // Positions and velocities are interleaved XZ pairs, so they are treated
+    // as flat float streams two props per four lanes. Skipped props have a
+    // zero step and stay where they are.
+    float const* pos = &mPosXZ[0].x;
+    float const* vel = &mVelocityXZ[0].x;
+    float* newPos = &mNewPosXZ[0].x;
+    uint32_t i = begin;
+
+#if defined(PROP_SYSTEM_AVX)
+    __m256 const half8 = _mm256_set1_ps( mHalfExtent );
+    __m256 const signMask8 = _mm256_set1_ps( -0.0f );
+    for (; i + 4 <= end; i += 4)
+    {
+        // Widen one step per prop to one per X and Z lane.
+        __m128 const dist4 = _mm_loadu_ps( &mStepDist[i] );
+        __m256 const dist8 = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_unpacklo_ps( dist4, dist4 ) ), _mm_unpackhi_ps( dist4, dist4 ), 1 );
+        __m256 const p = _mm256_add_ps( _mm256_loadu_ps( pos + i * 2 ), _mm256_mul_ps( _mm256_loadu_ps( vel + i * 2 ), dist8 ) );
+        _mm256_storeu_ps( newPos + i * 2, p );
+        int const outside = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_andnot_ps( signMask8, p ), half8, _CMP_GT_OQ ) );
+        mHitWall[i + 0] = (outside & 0x03) != 0;
+        mHitWall[i + 1] = (outside & 0x0c) != 0;
+        mHitWall[i + 2] = (outside & 0x30) != 0;
+        mHitWall[i + 3] = (outside & 0xc0) != 0;
+        _mm_storeu_ps( &mOverrideDist[i], _mm_max_ps( _mm_sub_ps( _mm_loadu_ps( &mOverrideDist[i] ), dist4 ), _mm_setzero_ps() ) );
+    }
+#elif defined(PROP_SYSTEM_SSE)
+    __m128 const half4 = _mm_set1_ps( mHalfExtent );
+    __m128 const signMask4 = _mm_set1_ps( -0.0f );
+    for (; i + 4 <= end; i += 4)
+    {
+        // Widen one step per prop to one per X and Z lane.
+        __m128 const dist4 = _mm_loadu_ps( &mStepDist[i] );
+        __m128 const p0 = _mm_add_ps( _mm_loadu_ps( pos + i * 2 ), _mm_mul_ps( _mm_loadu_ps( vel + i * 2 ), _mm_unpacklo_ps( dist4, dist4 ) ) );
+        __m128 const p1 = _mm_add_ps( _mm_loadu_ps( pos + i * 2 + 4 ), _mm_mul_ps( _mm_loadu_ps( vel + i * 2 + 4 ), _mm_unpackhi_ps( dist4, dist4 ) ) );
+        _mm_storeu_ps( newPos + i * 2, p0 );
+        _mm_storeu_ps( newPos + i * 2 + 4, p1 );
+        int const outside0 = _mm_movemask_ps( _mm_cmpgt_ps( _mm_andnot_ps( signMask4, p0 ), half4 ) );
+        int const outside1 = _mm_movemask_ps( _mm_cmpgt_ps( _mm_andnot_ps( signMask4, p1 ), half4 ) );
+        mHitWall[i + 0] = (outside0 & 0x3) != 0;
+        mHitWall[i + 1] = (outside0 & 0xc) != 0;
+        mHitWall[i + 2] = (outside1 & 0x3) != 0;
+        mHitWall[i + 3] = (outside1 & 0xc) != 0;
+        _mm_storeu_ps( &mOverrideDist[i], _mm_max_ps( _mm_sub_ps( _mm_loadu_ps( &mOverrideDist[i] ), dist4 ), _mm_setzero_ps() ) );
+    }
+#endif
+
+    for (; i < end; i++)
+    {
+        float const dist = mStepDist[i];
+        glm::vec2 const p = mPosXZ[i] + (mVelocityXZ[i] * dist);
+        mNewPosXZ[i] = p;
+        mHitWall[i] = glm::abs( p.x ) > mHalfExtent || glm::abs( p.y ) > mHalfExtent;
+        mOverrideDist[i] = glm::max( mOverrideDist[i] - dist, 0.0f );
+    }
+}
+
+//=============================================================================
+
+inline void PropSystem::Collide( uint32_t const begin, uint32_t const end )
+{
+    // A prop that would end up within the collision distance of any other
+    // prop's start of tick position stays put and turns around. Both props of
+    // a pair see each other, so each one only ever changes its own state.
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (mStepDist[i] == 0.0f)
+            continue;
+
+        bool collision = mHitWall[i] != 0;
+        glm::vec2 const newPos = mNewPosXZ[i];
+        if (!collision && mOverrideDist[i] == 0.0f)
+        {
+            mGrid.Query( newPos, [&]( uint32_t const j )
+            {
+                collision = j != i && glm::length( newPos - mPosXZ[j] ) < mCollisionDist;
+                return collision;
+            } );
+            if (collision)
+            {
+                mOverrideDist[i] = mCollisionDist;
+            }
+        }
+
+        if (collision)
+        {
+            mVelocityXZ[i] = -mVelocityXZ[i];
+            mNewPosXZ[i] = mPosXZ[i];
+        }
+    }
+}
+
+//=============================================================================
+
+inline void PropSystem::BuildInstanceChunk( uint32_t const chunk, float const interpolation, const Frustum* frustum, const OcclusionBuffer* occlusion )
+{
+    // Props face along their velocity. Only the position is interpolated;
+    // turning around is instant, so the heading is always the latest one, the
+    // angle that rotates (0, 0, 1) onto the velocity. For props the
+    // tree found crossing the view, the model's sphere goes to world space with
+    // the same rotation, as in shaders/model.vs, and is tested together with
+    // the next ones needing it. Without a frustum there are none.
+    uint32_t const begin = chunk * GRAIN;
+    uint32_t const end = std::min( begin + GRAIN, GetCount() );
+    float x[CULL_BLOCK];
+    float y[CULL_BLOCK];
+    float z[CULL_BLOCK];
+    float radius[CULL_BLOCK];
+    uint32_t tested[CULL_BLOCK];
+    uint8_t visible[CULL_BLOCK];
+    uint32_t numTested = 0;
+    auto const test = [&]()
+    {
+        if (numTested == 0)
+            return;
+        frustum->CullSpheres( x, y, z, radius, numTested, visible );
+        for (uint32_t n = 0; n < numTested; n++)
+        {
+            mVisible[tested[n]] = visible[n];
+        }
+        numTested = 0;
+    };
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (mVisible[i] == CULL_OUTSIDE)
+            continue;
+        glm::vec2 const posXZ = mPrevPosXZ[i] + (mPosXZ[i] - mPrevPosXZ[i]) * interpolation;
+        glm::vec2 const velocity = mVelocityXZ[i];
+        mInstance[i] = glm::vec4( posXZ.x, posXZ.y, std::atan2( velocity.x, velocity.y ), mScale[i] );
+        if (mVisible[i] == CULL_INSIDE)
+            continue;
+
+        // sin and cos of the heading straight from the velocity
+        float const speed = glm::length( velocity );
+        float const s = speed > 0.0f ? velocity.x / speed : 0.0f;
+        float const c = speed > 0.0f ? velocity.y / speed : 1.0f;
+        glm::vec4 const sphere = GetModelSphere( mModelIndex[i] );
+        glm::vec3 const center = glm::vec3( sphere ) * mScale[i];
+        x[numTested] = posXZ.x + c * center.x + s * center.z;
+        y[numTested] = center.y;
+        z[numTested] = posXZ.y + c * center.z - s * center.x;
+        radius[numTested] = sphere.w * mScale[i];
+        tested[numTested++] = i;
+        if (numTested == CULL_BLOCK)
+        {
+            test();
+        }
+    }
+    test();
+
+    // What survived the view goes up against the occluders, boxed at any heading, and then
+    // against the last query answer.
+    uint32_t occluded = 0;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (mVisible[i] && occlusion != nullptr)
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+            GetInstanceBox( i, min, max );
+            if (!occlusion->IsVisible( min, max ))
+            {
+                mVisible[i] = 0;
+                occluded++;
+            }
+        }
+
+        mQueryDue[i] = 0;
+        if (!mVisible[i] || mQueryInterval == 0)
+        {
+            mQueryHidden[i] = 0;
+            continue;
+        }
+        mQueryDue[i] = mQueryHidden[i] || (mQueryFrame + i) % mQueryInterval == 0;
+        if (mQueryHidden[i])
+        {
+            mVisible[i] = 0;
+            occluded++;
+        }
+    }
+    mChunkOccluded[chunk] = occluded;
+
+    uint32_t* const counts = &mChunkInstances[chunk * mInstanceModels];
+    for (uint32_t m = 0; m < mInstanceModels; m++)
+    {
+        counts[m] = 0;
+    }
+    for (uint32_t i = begin; i < end; i++)
+    {
+        counts[mModelIndex[i]] += mVisible[i];
+    }
+}
+
+//=============================================================================
+
+inline void PropSystem::WriteInstanceChunk( uint32_t const chunk, glm::vec4* out )
+{
+    // The chunk owns its row of offsets and bumps them as it writes.
+    uint32_t const begin = chunk * GRAIN;
+    uint32_t const end = std::min( begin + GRAIN, GetCount() );
+    uint32_t* const next = &mChunkInstances[chunk * mInstanceModels];
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (mVisible[i])
+        {
+            out[next[mModelIndex[i]]++] = mInstance[i];
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
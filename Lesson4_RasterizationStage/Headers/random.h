@@ -0,0 +1,65 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+//=============================================================================
+// Counter based random numbers (Widynski's Squares). A draw is a pure
+// function of (key, counter), so there is no shared state: any thread can
+// produce the numbers of any entity, in any order, and get the same values.
+//
+// Random derives its key from a seed, a stream (what the numbers are for)
+// and a frame, and its counter from an entity id plus a draw count. Same
+// seed, same ids, same frames: same numbers, whatever the thread count.
+//=============================================================================
+
+inline uint64_t RandomMix64( uint64_t x )
+{
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+//=============================================================================
+
+inline uint32_t RandomSquares32( uint64_t const counter, uint64_t const key )
+{
+    uint64_t x = counter * key;
+    uint64_t const y = x;
+    uint64_t const z = y + key;
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return (uint32_t)((x * x + z) >> 32);
+}
+
+//=============================================================================
+
+class Random
+{
+public:
+    Random( uint64_t const seed, uint32_t const stream, uint64_t const frame, uint32_t const id ):
+        // Squares wants an odd key with well mixed bits.
+        mKey( RandomMix64( seed ^ RandomMix64( ((uint64_t)stream << 48) ^ frame ) ) | 1 ),
+        mCounter( (uint64_t)id << 32 )
+    {
+    }
+
+    uint32_t NextUint() { return RandomSquares32( mCounter++, mKey ); }
+
+    // [0, n)
+    uint32_t NextBelow( uint32_t const n ) { return (uint32_t)(((uint64_t)NextUint() * n) >> 32); }
+
+    // [0, 1), 24 bits of precision
+    float NextFloat() { return (float)(NextUint() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+    uint64_t mKey;
+    uint64_t mCounter;
+};
+
+//=============================================================================
+
+#endif
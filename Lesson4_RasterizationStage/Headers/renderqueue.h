@@ -0,0 +1,132 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//=============================================================================
+// Draw packets sorted by a 64 bit key. From the most significant end the key
+// holds the pass, program, material, mesh and a depth bucket, so after the
+// sort draws sharing state are adjacent and the executor only rebinds what
+// actually changed. Within the same state, nearer draws come first.
+//
+//   63..60 pass | 59..52 program | 51..36 material | 35..20 mesh | 19..0 depth
+//=============================================================================
+
+struct DrawPacket
+{
+    uint64_t mKey;
+    uint32_t mItem;     // caller's per draw data, e.g. an index into a transform array
+    uint32_t mMesh;     // caller's mesh index
+};
+
+//=============================================================================
+
+class RenderQueue
+{
+public:
+    static uint32_t const PASS_BITS = 4;
+    static uint32_t const PROGRAM_BITS = 8;
+    static uint32_t const MATERIAL_BITS = 16;
+    static uint32_t const MESH_BITS = 16;
+    static uint32_t const DEPTH_BITS = 20;
+
+    static uint64_t MakeKey( uint32_t const pass, uint32_t const program, uint32_t const material, uint32_t const mesh, float const depth01 );
+    static uint32_t GetPass( uint64_t const key ) { return (uint32_t)(key >> 60); }
+    static uint32_t GetProgram( uint64_t const key ) { return (uint32_t)(key >> 52) & ((1u << PROGRAM_BITS) - 1); }
+    static uint32_t GetMaterial( uint64_t const key ) { return (uint32_t)(key >> 36) & ((1u << MATERIAL_BITS) - 1); }
+
+    // Capacity is kept across frames, so a steady scene never reallocates.
+    void Clear() { mPackets.clear(); }
+    void Reserve( uint32_t const count ) { mPackets.reserve( count ); mScratch.reserve( count ); }
+    void Submit( uint64_t const key, uint32_t const item, uint32_t const mesh ) { mPackets.push_back( DrawPacket{ key, item, mesh } ); }
+    // Adds packets built elsewhere, e.g. by a worker into its own list, moving their items up by itemBase.
+    void Append( const DrawPacket* packets, uint32_t const count, uint32_t const itemBase );
+    void Sort();
+
+    uint32_t GetCount() const { return (uint32_t)mPackets.size(); }
+    const DrawPacket* GetPackets() const { return mPackets.data(); }
+
+private:
+    std::vector<DrawPacket> mPackets;
+    std::vector<DrawPacket> mScratch;
+};
+
+//=============================================================================
+
+inline uint64_t RenderQueue::MakeKey( uint32_t const pass, uint32_t const program, uint32_t const material, uint32_t const mesh, float const depth01 )
+{
+    float const clamped = depth01 < 0.0f ? 0.0f : (depth01 > 1.0f ? 1.0f : depth01);
+    uint64_t const depth = (uint64_t)(clamped * (float)((1u << DEPTH_BITS) - 1));
+    return ((uint64_t)(pass & ((1u << PASS_BITS) - 1)) << 60) |
+           ((uint64_t)(program & ((1u << PROGRAM_BITS) - 1)) << 52) |
+           ((uint64_t)(material & ((1u << MATERIAL_BITS) - 1)) << 36) |
+           ((uint64_t)(mesh & ((1u << MESH_BITS) - 1)) << 20) |
+           depth;
+}
+
+//=============================================================================
+
+inline void RenderQueue::Append( const DrawPacket* packets, uint32_t const count, uint32_t const itemBase )
+{
+    size_t const first = mPackets.size();
+    mPackets.resize( first + count );
+    for (uint32_t i = 0; i < count; i++)
+    {
+        DrawPacket& packet = mPackets[first + i];
+        packet = packets[i];
+        packet.mItem += itemBase;
+    }
+}
+
+//=============================================================================
+
+inline void RenderQueue::Sort()
+{
+    // LSD radix sort, 8 bits per pass. Stable, so equal keys keep submit order.
+    // A pass whose digit is the same for every packet would not move anything
+    // and is skipped; with few programs and materials most of the high passes go.
+    uint32_t const count = GetCount();
+    if (count < 2)
+        return;
+    mScratch.resize( count );
+
+    DrawPacket* src = mPackets.data();
+    DrawPacket* dst = mScratch.data();
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t offsets[256];
+        memset( offsets, 0, sizeof( offsets ) );
+        for (uint32_t i = 0; i < count; i++)
+        {
+            offsets[(src[i].mKey >> shift) & 0xff]++;
+        }
+        if (offsets[(src[0].mKey >> shift) & 0xff] == count)
+            continue;
+
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < 256; b++)
+        {
+            uint32_t const n = offsets[b];
+            offsets[b] = sum;
+            sum += n;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[offsets[(src[i].mKey >> shift) & 0xff]++] = src[i];
+        }
+        DrawPacket* const swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != mPackets.data())
+    {
+        mPackets.swap( mScratch );
+    }
+}
+
+//=============================================================================
+
+#endif
@@ -4,18 +4,45 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <glstate.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+
+// typed uniform handle, resolved once through Shader::getUniform. Setting it is a single glUniform call.
+template<typename T>
+struct Uniform
+{
+    GLint location = -1;
+};
+
+// GL type each uniform handle type expects, checked when the handle is resolved.
+template<typename T> struct UniformType;
+template<> struct UniformType<bool> { static const GLenum value = GL_BOOL; };
+template<> struct UniformType<int> { static const GLenum value = GL_INT; };
+template<> struct UniformType<float> { static const GLenum value = GL_FLOAT; };
+template<> struct UniformType<glm::vec2> { static const GLenum value = GL_FLOAT_VEC2; };
+template<> struct UniformType<glm::vec3> { static const GLenum value = GL_FLOAT_VEC3; };
+template<> struct UniformType<glm::vec4> { static const GLenum value = GL_FLOAT_VEC4; };
+template<> struct UniformType<glm::mat2> { static const GLenum value = GL_FLOAT_MAT2; };
+template<> struct UniformType<glm::mat3> { static const GLenum value = GL_FLOAT_MAT3; };
+template<> struct UniformType<glm::mat4> { static const GLenum value = GL_FLOAT_MAT4; };
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly. defines, e.g. "#define INSTANCED\n", go
+    // right after the #version line of both stages, so one file can build several variants.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* defines = nullptr)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -45,6 +72,11 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if (defines != nullptr)
+        {
+            insertDefines(vertexCode, defines);
+            insertDefines(fragmentCode, defines);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -68,76 +100,295 @@ public:
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        // 3. cache every active uniform location so nothing asks the driver later
+        reflectUniforms();
 
     }
+    // compute shader program from a single file, GL 4.3 and up
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (const std::ifstream::failure&)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+        reflectUniforms();
+    }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     { 
-        glUseProgram(ID); 
+        GetGLState().UseProgram(ID);
     }
-    // utility uniform functions
+    // resolve a typed uniform handle; do this once at load time, not per draw.
+    // a name the program doesn't use gives a handle with location -1, which GL ignores.
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    template<typename T>
+    Uniform<T> getUniform(const char* name) const
+    {
+        Uniform<T> uniform;
+        const UniformInfo* info = findUniform(name);
+        if (info != nullptr)
+        {
+            // ints also set samplers
+            assert(info->type == UniformType<T>::value || (UniformType<T>::value == GL_INT && isSamplerType(info->type)));
+            uniform.location = info->location;
+        }
+        return uniform;
+    }
+    // set through a typed handle
+    // ------------------------------------------------------------------------
+    void set(Uniform<bool> uniform, bool value) const { glUniform1i(uniform.location, (int)value); }
+    void set(Uniform<int> uniform, int value) const { glUniform1i(uniform.location, value); }
+    void set(Uniform<float> uniform, float value) const { glUniform1f(uniform.location, value); }
+    void set(Uniform<glm::vec2> uniform, const glm::vec2 &value) const { glUniform2fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const { glUniform3fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const { glUniform4fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::mat2> uniform, const glm::mat2 &mat) const { glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    void set(Uniform<glm::mat3> uniform, const glm::mat3 &mat) const { glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4 &mat) const { glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    // texture unit a sampler uniform was given at link time, -1 if the program has no such sampler
+    // ------------------------------------------------------------------------
+    GLint getSamplerUnit(const char* name) const
+    {
+        const UniformInfo* info = findUniform(name);
+        return info != nullptr ? info->unit : -1;
+    }
+    // point a uniform block at a buffer binding point; glBindBufferRange on that point then
+    // feeds every program using the block. false if the program has no such block.
+    // ------------------------------------------------------------------------
+    bool bindUniformBlock(const char* name, GLuint binding) const
+    {
+        GLuint const index = glGetUniformBlockIndex(ID, name);
+        if (index == GL_INVALID_INDEX)
+            return false;
+        glUniformBlockBinding(ID, index, binding);
+        return true;
+    }
+    // location of a uniform by name from the reflected table, -1 if the program doesn't use it
+    // ------------------------------------------------------------------------
+    GLint getUniformLocation(const char* name) const
+    {
+        const UniformInfo* info = findUniform(name);
+        return info != nullptr ? info->location : -1;
+    }
+    // utility uniform functions; these look the name up in the reflected table, use handles in hot loops
+    // ------------------------------------------------------------------------
+    void setBool(const char* name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(getUniformLocation(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const char* name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const char* name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(getUniformLocation(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const char* name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(getUniformLocation(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(const char* name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(getUniformLocation(name), x, y); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const char* name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(getUniformLocation(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const char* name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(getUniformLocation(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const char* name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(getUniformLocation(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(const char* name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(getUniformLocation(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(const char* name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(const char* name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(const char* name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-        GLenum const err = glGetError();
-        assert( err == GL_NO_ERROR );
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    struct UniformInfo
+    {
+        uint32_t hash;
+        GLint location;
+        GLenum type;
+        GLint unit;             // texture unit of a sampler, -1 otherwise
+        uint32_t nameOffset;    // into uniformNames, ~0u marks an empty slot
+    };
+
+    // open addressed table of active uniforms, keyed by a hash of the name
+    std::vector<UniformInfo> uniformTable;
+    std::vector<char> uniformNames;
+
+    static uint32_t hashName(const char* name)
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (; *name; name++)
+            hash = (hash ^ (uint8_t)*name) * 16777619u;
+        return hash;
+    }
+
+    static bool isSamplerType(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    const UniformInfo* findUniform(const char* name) const
+    {
+        if (uniformTable.empty())
+            return nullptr;
+        uint32_t const mask = (uint32_t)uniformTable.size() - 1;
+        uint32_t const hash = hashName(name);
+        for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const UniformInfo& info = uniformTable[i];
+            if (info.nameOffset == ~0u)
+                return nullptr;
+            if (info.hash == hash && strcmp(&uniformNames[info.nameOffset], name) == 0)
+                return &info;
+        }
+    }
+
+    void insertUniform(const char* name, GLint location, GLenum type, GLint unit)
+    {
+        uint32_t const mask = (uint32_t)uniformTable.size() - 1;
+        uint32_t const hash = hashName(name);
+        uint32_t i = hash & mask;
+        while (uniformTable[i].nameOffset != ~0u)
+            i = (i + 1) & mask;
+        uniformTable[i].hash = hash;
+        uniformTable[i].location = location;
+        uniformTable[i].type = type;
+        uniformTable[i].unit = unit;
+        uniformTable[i].nameOffset = (uint32_t)uniformNames.size();
+        uniformNames.insert(uniformNames.end(), name, name + strlen(name) + 1);
+    }
+
+    // walk the program's active uniforms once after linking. arrays get an entry per element
+    // plus their bare name, block members have no location and are skipped. every sampler
+    // gets its own texture unit here, so meshes can resolve their textures to units at load.
+    // ------------------------------------------------------------------------
+    void reflectUniforms()
+    {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        struct Active { std::string name; GLint size; GLenum type; };
+        std::vector<Active> active;
+        std::vector<char> name(maxLength + 1);
+        uint32_t numEntries = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+            std::string uniformName(name.data(), length);
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                uniformName.resize(uniformName.size() - 3);
+            active.push_back(Active{ uniformName, size, type });
+            numEntries += size > 1 ? size + 1 : 1;
+        }
+
+        uint32_t capacity = 16;
+        while (capacity < numEntries * 2)
+            capacity *= 2;
+        uniformTable.assign(capacity, UniformInfo{ 0, -1, 0, -1, ~0u });
+        uniformNames.clear();
+
+        // glUniform1i needs the program bound; the state tracker knows it is, so no restore.
+        GetGLState().UseProgram(ID);
+        GLint nextUnit = 0;
+        char elementName[256];
+        for (const Active& uniform : active)
+        {
+            GLint const location = glGetUniformLocation(ID, uniform.name.c_str());
+            if (location < 0)
+                continue;
+            GLint const sampler = isSamplerType(uniform.type) ? nextUnit : -1;
+            insertUniform(uniform.name.c_str(), location, uniform.type, sampler);
+            for (GLint e = 0; uniform.size > 1 && e < uniform.size; e++)
+            {
+                snprintf(elementName, sizeof(elementName), "%s[%d]", uniform.name.c_str(), e);
+                GLint const unit = sampler >= 0 ? nextUnit + e : -1;
+                GLint const elementLocation = glGetUniformLocation(ID, elementName);
+                insertUniform(elementName, elementLocation, uniform.type, unit);
+                if (unit >= 0)
+                    glUniform1i(elementLocation, unit);
+            }
+            if (sampler >= 0 && uniform.size <= 1)
+                glUniform1i(location, sampler);
+            if (sampler >= 0)
+                nextUnit += uniform.size;
+        }
+    }
+
+    // put defines after the #version line, which has to come first.
+    // ------------------------------------------------------------------------
+    static void insertDefines(std::string& code, const char* defines)
+    {
+        size_t const version = code.find("#version");
+        size_t const lineEnd = version != std::string::npos ? code.find('\n', version) : std::string::npos;
+        code.insert(lineEnd != std::string::npos ? lineEnd + 1 : 0, defines);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,130 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+// Uniform grid broadphase over a square XZ area centred on the origin.
+// Items are bucketed by a counting sort, so every cell's items are contiguous
+// and a row of neighbouring cells is a single contiguous run.
+//=============================================================================
+
+class SpatialGrid
+{
+public:
+    SpatialGrid( float const cellSize, float const halfExtent );
+
+    // Re-bucket 'count' items; getPos( i ) returns the XZ position of item i.
+    template<typename PosFn>
+    void Build( uint32_t const count, PosFn getPos );
+
+    // Visit every item in the 3x3 cells around pos. fn( index ) returns true to stop.
+    // Finds everything within cellSize of pos, so size cells to the query radius.
+    template<typename VisitFn>
+    void Query( const glm::vec2& pos, VisitFn fn ) const;
+
+    float GetCellSize() const { return mCellSize; }
+
+private:
+    uint32_t CellCoord( float const v ) const;
+
+    float mCellSize;
+    float mInvCellSize;
+    float mHalfExtent;
+    uint32_t mDim;
+    std::vector<uint32_t> mCellStart;   // mDim * mDim + 1 prefix offsets into mItems
+    std::vector<uint32_t> mItemCell;
+    std::vector<uint32_t> mItems;
+};
+
+//=============================================================================
+
+inline SpatialGrid::SpatialGrid( float const cellSize, float const halfExtent ):
+    mCellSize( cellSize ),
+    mInvCellSize( 1.0f / cellSize ),
+    mHalfExtent( halfExtent )
+{
+    assert( cellSize > 0.0f && halfExtent > 0.0f );
+    mDim = std::max( (uint32_t)glm::ceil( (halfExtent * 2.0f) / cellSize ), 1u );
+    mCellStart.resize( mDim * mDim + 1, 0 );
+}
+
+//=============================================================================
+
+inline uint32_t SpatialGrid::CellCoord( float const v ) const
+{
+    // Anything on or outside the border is clamped into the edge cells.
+    int const c = (int)glm::floor( (v + mHalfExtent) * mInvCellSize );
+    return (uint32_t)glm::clamp( c, 0, (int)mDim - 1 );
+}
+
+//=============================================================================
+
+template<typename PosFn>
+void SpatialGrid::Build( uint32_t const count, PosFn getPos )
+{
+    mItemCell.resize( count );
+    mItems.resize( count );
+    std::fill( mCellStart.begin(), mCellStart.end(), 0 );
+
+    // Count items per cell.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        glm::vec2 const pos = getPos( i );
+        uint32_t const cell = CellCoord( pos.y ) * mDim + CellCoord( pos.x );
+        mItemCell[i] = cell;
+        mCellStart[cell + 1]++;
+    }
+
+    // Prefix sum into start offsets.
+    for (uint32_t c = 0; c < mDim * mDim; c++)
+    {
+        mCellStart[c + 1] += mCellStart[c];
+    }
+
+    // Scatter, walking the items in order keeps each cell sorted by index.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        mItems[mCellStart[mItemCell[i]]++] = i;
+    }
+
+    // Scattering advanced every start to the next cell's start; shift back.
+    for (uint32_t c = mDim * mDim; c > 0; c--)
+    {
+        mCellStart[c] = mCellStart[c - 1];
+    }
+    mCellStart[0] = 0;
+}
+
+//=============================================================================
+
+template<typename VisitFn>
+void SpatialGrid::Query( const glm::vec2& pos, VisitFn fn ) const
+{
+    uint32_t const cx = CellCoord( pos.x );
+    uint32_t const cy = CellCoord( pos.y );
+    uint32_t const x0 = cx > 0 ? cx - 1 : 0;
+    uint32_t const x1 = std::min( cx + 1, mDim - 1 );
+    uint32_t const y0 = cy > 0 ? cy - 1 : 0;
+    uint32_t const y1 = std::min( cy + 1, mDim - 1 );
+    for (uint32_t y = y0; y <= y1; y++)
+    {
+        // Cells of a row are adjacent, so x0..x1 is one run of items.
+        uint32_t const begin = mCellStart[y * mDim + x0];
+        uint32_t const end = mCellStart[y * mDim + x1 + 1];
+        for (uint32_t i = begin; i < end; i++)
+        {
+            if (fn( mItems[i] ))
+                return;
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
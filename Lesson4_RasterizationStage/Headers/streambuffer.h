@@ -0,0 +1,220 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//=============================================================================
+// Ring buffer for data the CPU writes every frame and the GPU reads once:
+// instance data, indirect commands, uniform blocks. One GL buffer is split
+// into FRAME_COUNT regions; a frame writes into its own region while the GPU
+// may still read the previous ones, and a fence per region keeps the CPU
+// from overwriting a region before the GPU is done with it.
+//
+// With GL 4.4 / ARB_buffer_storage the buffer is persistently and coherently
+// mapped: Alloc hands out pointers straight into GPU visible memory, with no
+// map/unmap and no driver side copy. Without it Alloc hands out pointers into
+// a CPU copy, and Flush uploads the frame's region with glBufferSubData.
+//
+// Per frame: BeginFrame, Alloc and write, Flush, issue the draws, EndFrame.
+// Allocations past the region's end return nullptr; the region grows at the
+// next BeginFrame, so size it for the peak up front.
+//=============================================================================
+
+struct StreamAlloc
+{
+    void* mData;        // where to write, nullptr if the region is full
+    size_t mOffset;     // byte offset in GetBuffer(), for binding and draw offsets
+};
+
+//=============================================================================
+
+class StreamBuffer
+{
+public:
+    static uint32_t const FRAME_COUNT = 3;
+
+    StreamBuffer();
+    ~StreamBuffer() { Destroy(); }
+    StreamBuffer( const StreamBuffer& ) = delete;
+    StreamBuffer& operator=( const StreamBuffer& ) = delete;
+
+    void Create( size_t const frameSize );
+
+    void BeginFrame();
+    StreamAlloc Alloc( size_t const size, size_t const align );
+    void Flush();
+    void EndFrame();
+
+    GLuint GetBuffer() const { return mBuffer; }
+    bool IsPersistent() const { return mPersistent; }
+    size_t GetFrameSize() const { return mFrameSize; }
+    size_t GetUsed() const { return mUsed; }
+    uint32_t GetWaitCount() const { return mWaitCount; }     // BeginFrames that found the GPU still reading
+
+private:
+    void Destroy();
+    void WaitForRegion( uint32_t const region );
+
+    GLuint mBuffer;
+    uint8_t* mMapped;                       // whole buffer, persistent or the CPU copy
+    std::unique_ptr<uint8_t[]> mShadow;     // the CPU copy when not persistent
+    bool mPersistent;
+    size_t mFrameSize;
+    uint32_t mRegion;
+    size_t mUsed;
+    size_t mOverflow;                       // bytes the last frames asked for beyond the region
+    GLsync mFences[FRAME_COUNT];
+    uint32_t mWaitCount;
+};
+
+//=============================================================================
+
+inline StreamBuffer::StreamBuffer():
+    mBuffer( 0 ),
+    mMapped( nullptr ),
+    mPersistent( false ),
+    mFrameSize( 0 ),
+    mRegion( 0 ),
+    mUsed( 0 ),
+    mOverflow( 0 ),
+    mWaitCount( 0 )
+{
+    for (GLsync& fence : mFences)
+    {
+        fence = nullptr;
+    }
+}
+
+//=============================================================================
+
+inline void StreamBuffer::Create( size_t const frameSize )
+{
+    Destroy();
+    mFrameSize = frameSize;
+    mPersistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    size_t const size = mFrameSize * FRAME_COUNT;
+
+    glGenBuffers( 1, &mBuffer );
+    glBindBuffer( GL_ARRAY_BUFFER, mBuffer );
+    if (mPersistent)
+    {
+        GLbitfield const flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage( GL_ARRAY_BUFFER, (GLsizeiptr)size, nullptr, flags );
+        mMapped = (uint8_t*)glMapBufferRange( GL_ARRAY_BUFFER, 0, (GLsizeiptr)size, flags );
+        assert( mMapped != nullptr );
+    }
+    else
+    {
+        glBufferData( GL_ARRAY_BUFFER, (GLsizeiptr)size, nullptr, GL_STREAM_DRAW );
+        mShadow.reset( new uint8_t[size] );
+        mMapped = mShadow.get();
+    }
+    mRegion = 0;
+    mUsed = 0;
+    mOverflow = 0;
+}
+
+//=============================================================================
+
+inline void StreamBuffer::Destroy()
+{
+    if (mBuffer == 0)
+        return;
+
+    // Nothing may still read the buffer once it is gone.
+    for (uint32_t i = 0; i < FRAME_COUNT; i++)
+    {
+        WaitForRegion( i );
+    }
+    if (mPersistent)
+    {
+        glBindBuffer( GL_ARRAY_BUFFER, mBuffer );
+        glUnmapBuffer( GL_ARRAY_BUFFER );
+    }
+    glDeleteBuffers( 1, &mBuffer );
+    mBuffer = 0;
+    mMapped = nullptr;
+    mShadow.reset();
+}
+
+//=============================================================================
+
+inline void StreamBuffer::WaitForRegion( uint32_t const region )
+{
+    GLsync& fence = mFences[region];
+    if (fence == nullptr)
+        return;
+
+    // Poll first so the stats only count real stalls.
+    GLenum result = glClientWaitSync( fence, 0, 0 );
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        mWaitCount++;
+        while (result == GL_TIMEOUT_EXPIRED)
+        {
+            result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+        }
+    }
+    glDeleteSync( fence );
+    fence = nullptr;
+}
+
+//=============================================================================
+
+inline void StreamBuffer::BeginFrame()
+{
+    // A region too small last time is regrown here, before anything points into it.
+    if (mOverflow > 0)
+    {
+        Create( mFrameSize + mOverflow + mOverflow / 2 );
+    }
+    mRegion = (mRegion + 1) % FRAME_COUNT;
+    WaitForRegion( mRegion );
+    mUsed = 0;
+}
+
+//=============================================================================
+
+inline StreamAlloc StreamBuffer::Alloc( size_t const size, size_t const align )
+{
+    assert( align != 0 && (align & (align - 1)) == 0 );
+    size_t const regionStart = mRegion * mFrameSize;
+
+    // Align the absolute offset, which is what GL checks.
+    size_t const start = (regionStart + mUsed + align - 1) & ~(align - 1);
+    if (start + size > regionStart + mFrameSize)
+    {
+        mOverflow += size + align;
+        return StreamAlloc{ nullptr, 0 };
+    }
+    mUsed = start + size - regionStart;
+    return StreamAlloc{ mMapped + start, start };
+}
+
+//=============================================================================
+
+inline void StreamBuffer::Flush()
+{
+    // Coherent memory is already visible to the GPU; the fallback uploads what was written.
+    if (mPersistent || mUsed == 0)
+        return;
+    glBindBuffer( GL_ARRAY_BUFFER, mBuffer );
+    glBufferSubData( GL_ARRAY_BUFFER, (GLintptr)(mRegion * mFrameSize), (GLsizeiptr)mUsed, mMapped + mRegion * mFrameSize );
+}
+
+//=============================================================================
+
+inline void StreamBuffer::EndFrame()
+{
+    // After the frame's draws: the region is free again once the GPU gets here.
+    mFences[mRegion] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+}
+
+//=============================================================================
+
+#endif
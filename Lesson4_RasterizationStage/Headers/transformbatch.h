@@ -0,0 +1,210 @@
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORM_BATCH_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_BATCH_SSE
+#endif
+
+//=============================================================================
+// Batched model / normal matrix builder for upright objects described by an
+// XZ position, an XZ heading and a uniform scale.
+//
+// model = translate( x, 0, z ) * rotate( heading ) * scale( s ), with the
+// rotation columns (hz,0,-hx), (0,1,0), (hx,0,hz) for the unit heading (hx,hz).
+// That is the basis inverse( lookAt( 0, -heading, up ) ) yields, built without
+// the lookAt or the 4x4 inverse. The normal matrix of a rotation and uniform
+// scale is just the rotation, so it needs no normalization either.
+//
+// Output is tightly packed column major glm::mat4 / glm::mat3, the layout
+// glUniformMatrix*fv and buffer uploads take as is. Works on 8 objects per
+// step with AVX, 4 with SSE2, and one at a time for the tail.
+//=============================================================================
+
+#if defined(TRANSFORM_BATCH_SSE)
+
+// Deinterleave four XZ pairs, blended from prev by t, into X and Z lanes.
+inline void TransformBatchLoadXZ( const glm::vec2* cur, const glm::vec2* prev, __m128 const t, __m128& outX, __m128& outZ )
+{
+    __m128 const prev01 = _mm_loadu_ps( &prev[0].x );
+    __m128 const prev23 = _mm_loadu_ps( &prev[2].x );
+    __m128 const p01 = _mm_add_ps( prev01, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &cur[0].x ), prev01 ), t ) );
+    __m128 const p23 = _mm_add_ps( prev23, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &cur[2].x ), prev23 ), t ) );
+    outX = _mm_shuffle_ps( p01, p23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+    outZ = _mm_shuffle_ps( p01, p23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+}
+
+//=============================================================================
+
+inline void TransformBatchLoadXZ( const glm::vec2* v, __m128& outX, __m128& outZ )
+{
+    __m128 const v01 = _mm_loadu_ps( &v[0].x );
+    __m128 const v23 = _mm_loadu_ps( &v[2].x );
+    outX = _mm_shuffle_ps( v01, v23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+    outZ = _mm_shuffle_ps( v01, v23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+}
+
+//=============================================================================
+
+// Write four model matrices (and normal matrices) from lanes of position,
+// unit heading and scale.
+inline void TransformBatchStore4( __m128 const px, __m128 const pz, __m128 const hx, __m128 const hz, __m128 const s,
+                                  glm::mat4* outModel, glm::mat3* outNormal )
+{
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps( 1.0f );
+    __m128 const sx = _mm_mul_ps( hx, s );
+    __m128 const sz = _mm_mul_ps( hz, s );
+    __m128 const nsx = _mm_sub_ps( zero, sx );
+
+    // Interleave lanes into (a, 0, b, 0) style columns, objects 0-1 then 2-3.
+    __m128 const c0lo = _mm_unpacklo_ps( sz, zero );
+    __m128 const c0hi = _mm_unpackhi_ps( sz, zero );
+    __m128 const c0zlo = _mm_unpacklo_ps( nsx, zero );
+    __m128 const c0zhi = _mm_unpackhi_ps( nsx, zero );
+    __m128 const c1lo = _mm_unpacklo_ps( zero, s );
+    __m128 const c1hi = _mm_unpackhi_ps( zero, s );
+    __m128 const c2lo = _mm_unpacklo_ps( sx, zero );
+    __m128 const c2hi = _mm_unpackhi_ps( sx, zero );
+    __m128 const c2zlo = _mm_unpacklo_ps( sz, zero );
+    __m128 const c2zhi = _mm_unpackhi_ps( sz, zero );
+    __m128 const c3lo = _mm_unpacklo_ps( px, zero );
+    __m128 const c3hi = _mm_unpackhi_ps( px, zero );
+    __m128 const c3zlo = _mm_unpacklo_ps( pz, one );
+    __m128 const c3zhi = _mm_unpackhi_ps( pz, one );
+
+    float* m0 = &outModel[0][0][0];
+    float* m1 = &outModel[1][0][0];
+    float* m2 = &outModel[2][0][0];
+    float* m3 = &outModel[3][0][0];
+    _mm_storeu_ps( m0 + 0, _mm_movelh_ps( c0lo, c0zlo ) );
+    _mm_storeu_ps( m1 + 0, _mm_movehl_ps( c0zlo, c0lo ) );
+    _mm_storeu_ps( m2 + 0, _mm_movelh_ps( c0hi, c0zhi ) );
+    _mm_storeu_ps( m3 + 0, _mm_movehl_ps( c0zhi, c0hi ) );
+    _mm_storeu_ps( m0 + 4, _mm_movelh_ps( c1lo, zero ) );
+    _mm_storeu_ps( m1 + 4, _mm_movehl_ps( zero, c1lo ) );
+    _mm_storeu_ps( m2 + 4, _mm_movelh_ps( c1hi, zero ) );
+    _mm_storeu_ps( m3 + 4, _mm_movehl_ps( zero, c1hi ) );
+    _mm_storeu_ps( m0 + 8, _mm_movelh_ps( c2lo, c2zlo ) );
+    _mm_storeu_ps( m1 + 8, _mm_movehl_ps( c2zlo, c2lo ) );
+    _mm_storeu_ps( m2 + 8, _mm_movelh_ps( c2hi, c2zhi ) );
+    _mm_storeu_ps( m3 + 8, _mm_movehl_ps( c2zhi, c2hi ) );
+    _mm_storeu_ps( m0 + 12, _mm_movelh_ps( c3lo, c3zlo ) );
+    _mm_storeu_ps( m1 + 12, _mm_movehl_ps( c3zlo, c3lo ) );
+    _mm_storeu_ps( m2 + 12, _mm_movelh_ps( c3hi, c3zhi ) );
+    _mm_storeu_ps( m3 + 12, _mm_movehl_ps( c3zhi, c3hi ) );
+
+    if (outNormal != nullptr)
+    {
+        // Four mat3s are 36 contiguous floats; fill them as nine vectors.
+        // Object k is (hz, 0, -hx, 0, 1, 0, hx, 0, hz).
+        __m128 const nhx = _mm_sub_ps( zero, hx );
+        __m128 const zx01 = _mm_unpacklo_ps( hz, hx );      // hz0 hx0 hz1 hx1
+        __m128 const zx23 = _mm_unpackhi_ps( hz, hx );      // hz2 hx2 hz3 hx3
+        __m128 const n01 = _mm_unpacklo_ps( nhx, zero );    // -hx0 0 -hx1 0
+        __m128 const n23 = _mm_unpackhi_ps( nhx, zero );    // -hx2 0 -hx3 0
+        __m128 const x01 = _mm_unpacklo_ps( hx, zero );     // hx0 0 hx1 0
+        __m128 const x23 = _mm_unpackhi_ps( hx, zero );     // hx2 0 hx3 0
+        __m128 const z01 = _mm_unpacklo_ps( hz, zero );     // hz0 0 hz1 0
+        __m128 const z23 = _mm_unpackhi_ps( hz, zero );     // hz2 0 hz3 0
+        __m128 const unitX = _mm_setr_ps( 1.0f, 0.0f, 0.0f, 0.0f );
+        __m128 const unitY = _mm_setr_ps( 0.0f, 1.0f, 0.0f, 0.0f );
+        float* n = &outNormal[0][0][0];
+
+        // Objects 0 and 1, floats 0-17.
+        _mm_storeu_ps( n + 0, _mm_movelh_ps( z01, n01 ) );                                  // hz0 0 -hx0 0
+        _mm_storeu_ps( n + 4, _mm_movelh_ps( unitX, x01 ) );                                // 1 0 hx0 0
+        _mm_storeu_ps( n + 8, _mm_shuffle_ps( zx01, n01, _MM_SHUFFLE( 2, 1, 2, 0 ) ) );    // hz0 | hz1 0 -hx1
+        _mm_storeu_ps( n + 12, _mm_shuffle_ps( unitY, x01, _MM_SHUFFLE( 2, 1, 1, 0 ) ) );  // 0 1 0 hx1
+        _mm_storeu_ps( n + 16, _mm_shuffle_ps( z01, z01, _MM_SHUFFLE( 1, 1, 2, 1 ) ) );    // 0 hz1, rest overwritten below
+
+        // Objects 2 and 3, floats 18-35.
+        _mm_storeu_ps( n + 18, _mm_movelh_ps( z23, n23 ) );
+        _mm_storeu_ps( n + 22, _mm_movelh_ps( unitX, x23 ) );
+        _mm_storeu_ps( n + 26, _mm_shuffle_ps( zx23, n23, _MM_SHUFFLE( 2, 1, 2, 0 ) ) );
+        _mm_storeu_ps( n + 30, _mm_shuffle_ps( unitY, x23, _MM_SHUFFLE( 2, 1, 1, 0 ) ) );
+        n[34] = 0.0f;
+        n[35] = _mm_cvtss_f32( _mm_shuffle_ps( hz, hz, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+    }
+}
+
+#endif
+
+//=============================================================================
+
+// posXZ is blended from prevPosXZ by interpolation; pass prevPosXZ == posXZ
+// and 1 when there is nothing to blend. outNormal may be null.
+inline void BuildTransformBatch( const glm::vec2* posXZ, const glm::vec2* prevPosXZ, float const interpolation,
+                                 const glm::vec2* headingXZ, const float* scale, uint32_t const count,
+                                 glm::mat4* outModel, glm::mat3* outNormal )
+{
+    uint32_t i = 0;
+
+#if defined(TRANSFORM_BATCH_AVX)
+    // Gather eight objects into 8 wide lanes, do the normalize at full width,
+    // then hand the halves to the 4 wide store.
+    __m128 const t4 = _mm_set1_ps( interpolation );
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 pxLo, pzLo, pxHi, pzHi, hxLo, hzLo, hxHi, hzHi;
+        TransformBatchLoadXZ( posXZ + i, prevPosXZ + i, t4, pxLo, pzLo );
+        TransformBatchLoadXZ( posXZ + i + 4, prevPosXZ + i + 4, t4, pxHi, pzHi );
+        TransformBatchLoadXZ( headingXZ + i, hxLo, hzLo );
+        TransformBatchLoadXZ( headingXZ + i + 4, hxHi, hzHi );
+        __m256 hx = _mm256_insertf128_ps( _mm256_castps128_ps256( hxLo ), hxHi, 1 );
+        __m256 hz = _mm256_insertf128_ps( _mm256_castps128_ps256( hzLo ), hzHi, 1 );
+        __m256 const invLen = _mm256_div_ps( _mm256_set1_ps( 1.0f ), _mm256_sqrt_ps( _mm256_add_ps( _mm256_mul_ps( hx, hx ), _mm256_mul_ps( hz, hz ) ) ) );
+        hx = _mm256_mul_ps( hx, invLen );
+        hz = _mm256_mul_ps( hz, invLen );
+        __m256 const s = _mm256_loadu_ps( scale + i );
+        TransformBatchStore4( pxLo, pzLo, _mm256_castps256_ps128( hx ), _mm256_castps256_ps128( hz ), _mm256_castps256_ps128( s ),
+                              outModel + i, outNormal != nullptr ? outNormal + i : nullptr );
+        TransformBatchStore4( pxHi, pzHi, _mm256_extractf128_ps( hx, 1 ), _mm256_extractf128_ps( hz, 1 ), _mm256_extractf128_ps( s, 1 ),
+                              outModel + i + 4, outNormal != nullptr ? outNormal + i + 4 : nullptr );
+    }
+#endif
+
+#if defined(TRANSFORM_BATCH_SSE)
+    __m128 const t = _mm_set1_ps( interpolation );
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 px, pz, hx, hz;
+        TransformBatchLoadXZ( posXZ + i, prevPosXZ + i, t, px, pz );
+        TransformBatchLoadXZ( headingXZ + i, hx, hz );
+        __m128 const invLen = _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( hx, hx ), _mm_mul_ps( hz, hz ) ) ) );
+        TransformBatchStore4( px, pz, _mm_mul_ps( hx, invLen ), _mm_mul_ps( hz, invLen ), _mm_loadu_ps( scale + i ),
+                              outModel + i, outNormal != nullptr ? outNormal + i : nullptr );
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        glm::vec2 const h = headingXZ[i] * (1.0f / glm::length( headingXZ[i] ));
+        glm::vec2 const p = prevPosXZ[i] + ((posXZ[i] - prevPosXZ[i]) * interpolation);
+        float const s = scale[i];
+        glm::mat4& m = outModel[i];
+        m[0] = glm::vec4( h.y * s, 0.0f, -h.x * s, 0.0f );
+        m[1] = glm::vec4( 0.0f, s, 0.0f, 0.0f );
+        m[2] = glm::vec4( h.x * s, 0.0f, h.y * s, 0.0f );
+        m[3] = glm::vec4( p.x, 0.0f, p.y, 1.0f );
+        if (outNormal != nullptr)
+        {
+            glm::mat3& n = outNormal[i];
+            n[0] = glm::vec3( h.y, 0.0f, -h.x );
+            n[1] = glm::vec3( 0.0f, 1.0f, 0.0f );
+            n[2] = glm::vec3( h.x, 0.0f, h.y );
+        }
+    }
+}
+
+//=============================================================================
+
+#endif
@@ -4,11 +4,35 @@
 
 #include "model.h"
 #include "shader.h"
+#include "bounds.h"
+#include "framearena.h"
+#include "framepipeline.h"
+#include "geometryarena.h"
+#include "glstate.h"
+#include "gpuculling.h"
+#include "frustum.h"
+#include "jobsystem.h"
+#include "entityworld.h"
+#include "objectpool.h"
+#include "occlusion.h"
+#include "occlusionqueries.h"
+#include "propsystem.h"
+#include "random.h"
+#include "renderqueue.h"
+#include "streambuffer.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <new>
+#include <thread>
 #include <vector>
 #include <iostream>
 
@@ -19,72 +43,315 @@ const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 const float FLOOR_SIZE = 50.0f;
 const float FLOOR_HALF_SIZE = FLOOR_SIZE * 0.5f;
+const float PROP_COLLISION_DIST = 0.5f;
+const uint32_t NUM_PROPS = 50000;
+const uint32_t SUBMIT_GRAIN = 256;              // renderables per draw list job
+const uint32_t MAX_LIGHTS = 10;                 // numLights in shaders/model.vs and model.fs
+const GLuint CAMERA_BLOCK_BINDING = 0;          // uniform buffer binding points
+const GLuint LIGHT_BLOCK_BINDING = 1;
+const float CAMERA_FAR_PLANE = 100.0f;
+const uint32_t OCCLUSION_WIDTH = 256;           // software depth buffer for occlusion culling
+const uint32_t OCCLUSION_HEIGHT = 128;
+const uint32_t OCCLUDER_PROP_COUNT = 32;        // nearest props drawn as occluders
+const float OCCLUDER_PROP_DISTANCE = 15.0f;     // and how far away they may be
+const uint32_t OCCLUSION_QUERY_INTERVAL = 8;    // frames between hardware queries of a visible prop
+const uint32_t OCCLUSION_QUERY_BUDGET = 1024;   // queries issued per frame at most
+const uint32_t OCCLUSION_QUERY_CAPACITY = 4096; // queries in flight at most
+const GLuint INSTANCE_ATTRIBUTE = 5;            // aInstance in shaders/model.vs
+const float SIM_TICK_RATE = 60.0f;              // fixed simulation steps per second
+const uint32_t SIM_MAX_STEPS_PER_FRAME = 4;     // beyond this a slow frame drops sim time
+const uint64_t RANDOM_SEED = 0x5eed;            // same seed, same run
+const double STATS_INTERVAL = 1.0;              // seconds between window title stats updates
+
+// render passes, the top bits of a draw packet's sort key
+enum : uint32_t
+{
+    RENDER_PASS_OPAQUE,
+};
 
-//=============================================================================
+// shader programs, by their sort key id
+enum : uint32_t
+{
+    RENDER_PROGRAM_MODEL,
+    RENDER_PROGRAM_INSTANCED,    // model.vs with INSTANCED, one draw per mesh for all props of a model
+    RENDER_PROGRAM_COUNT,
+};
+
+// random streams, so draws made for different things never overlap
+enum : uint32_t
+{
+    RANDOM_PROP_SPAWN,
+    RANDOM_LIGHT_SPAWN,
+    RANDOM_LIGHT_COLOR,
+    RANDOM_BOUNCE,
+};
 
-struct Object
+// prop models, each with the box it hides others behind, in model space; the box must stay
+// inside the mesh (see OcclusionBuffer), so it is the torso from above the crotch to below
+// the shoulders, narrower than the waist, measured from the model's vertices
+struct PropModelDesc
+{
+    const char* mPath;
+    glm::vec3 mOccluderMin;
+    glm::vec3 mOccluderMax;
+};
+const PropModelDesc PROP_MODELS[] =
 {
-    virtual ~Object() {};
-    virtual void Update( float const deltaTime ) {};
-    virtual void Render() {};
+    { "objects/nanosuit/nanosuit.obj", glm::vec3( -1.2f, 6.5f, -0.6f ), glm::vec3( 1.2f, 12.0f, 0.5f ) },
+    { "objects/cyborg/cyborg.obj", glm::vec3( -0.25f, 1.85f, -0.18f ), glm::vec3( 0.25f, 2.8f, 0.18f ) },
 };
 
 //=============================================================================
+// Count every heap allocation so the frame stats can show allocations per
+// frame. Steady state frames should show zero; transient data belongs in
+// the frame arena.
+//=============================================================================
+
+static std::atomic<uint64_t> gHeapAllocCount( 0 );
+
+void* operator new( size_t size )
+{
+    gHeapAllocCount.fetch_add( 1, std::memory_order_relaxed );
+    void* const ptr = malloc( size != 0 ? size : 1 );
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
 
-struct Prop : public Object
+void operator delete( void* ptr ) noexcept
 {
-    Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader, float const scale );
-    virtual ~Prop() {};
-    virtual void Update( float const deltaTime ) override;
-    virtual void Render() override;
+    free( ptr );
+}
+
+void operator delete( void* ptr, size_t ) noexcept
+{
+    free( ptr );
+}
 
-    std::shared_ptr<Model> mModel;
-    std::shared_ptr<Shader> mShader;
-    glm::mat4 mTransform;
-    glm::vec2 mPosXZ;
-    glm::vec2 mVelocityXZ;
-    float mScale;
-    float mOverrideDist;
-    uint32_t mUpdateFrame;
+//=============================================================================
+
+typedef ObjectPool<Model>::Handle ModelHandle;
+typedef ObjectPool<Shader>::Handle ShaderHandle;
+
+//=============================================================================
+// Components are plain data; the systems below only touch the ones they need.
+//=============================================================================
+
+struct Transform
+{
+    glm::vec3 mPosition;
+    glm::vec3 mPrevPosition;    // mPosition before the last sim tick
+    glm::vec3 mScale;
 };
 
 //=============================================================================
 
-struct Floor : public Object
+struct Velocity
 {
-    Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader );
-    virtual ~Floor() {};
-    virtual void Render() override;
+    glm::vec2 mDirectionXZ;     // unit length
+    float mSpeed;               // meters per second
+};
+
+//=============================================================================
 
-    std::shared_ptr<Model> mModel;
-    std::shared_ptr<Shader> mShader;
-    glm::mat4 mTransform;
+struct Renderable
+{
+    ModelHandle mModel;     // drawn with RENDER_PROGRAM_MODEL
+    float mShininess;
+    float mDiffuseScale;
+    float mSpecularScale;
+    bool mOccluder;         // its model's box goes into the occlusion buffer
 };
 
 //=============================================================================
 
-struct Camera : public Object
+struct PointLight
 {
-    Camera();
-    virtual ~Camera() {};
-    virtual void Update( float const deltaTime ) override;
+    glm::vec3 mColor;
+    float mRadius;
+};
 
-    glm::vec3 mPosition;
+//=============================================================================
+
+struct Camera
+{
     glm::vec2 mPitchYaw;
 };
 
 //=============================================================================
 
-struct Light : public Object
+typedef EntityWorld<Transform, Velocity, Renderable, PointLight, Camera> World;
+
+//=============================================================================
+// Per draw uniform handles of shaders/model.vs and model.fs, resolved once at
+// load. Frame globals live in the uniform blocks below instead.
+//=============================================================================
+
+struct ModelUniforms
 {
-    Light( const glm::vec3& color );
-    virtual ~Light() {};
-    virtual void Update( float const deltaTime ) override;
+    void Resolve( const Shader& shader );
 
-    glm::vec2 mPosXZ;
-    glm::vec2 mVelocityXZ;
-    glm::vec3 mColor;
-    float mRadius;
+    Uniform<glm::mat4> mModel;
+    Uniform<glm::mat3> mITModel;
+    Uniform<float> mShininess;
+    Uniform<float> mDiffuseScale;
+    Uniform<float> mSpecularScale;
+};
+
+//=============================================================================
+// std140 mirrors of the Camera and Lights blocks in shaders/model.vs and
+// model.fs. Everything is a vec4 or a mat4, so no member needs padding.
+//=============================================================================
+
+struct CameraBlock
+{
+    glm::mat4 mView;
+    glm::mat4 mProjection;
+    glm::vec4 mCameraPos;                       // xyz
+};
+
+static_assert( sizeof( CameraBlock ) == 144, "CameraBlock must match the std140 Camera block" );
+
+//=============================================================================
+
+struct LightBlock
+{
+    glm::vec4 mPositionRadius[MAX_LIGHTS];      // xyz position, w radius
+    glm::vec4 mColor[MAX_LIGHTS];               // rgb
+};
+
+static_assert( sizeof( LightBlock ) == 32 * MAX_LIGHTS, "LightBlock must match the std140 Lights block" );
+
+//=============================================================================
+
+struct RenderProgram
+{
+    ShaderHandle mShader;
+    ModelUniforms mUniforms;
+};
+
+//=============================================================================
+// Render queue data. A DrawItem is one object's per draw state; every mesh
+// of the object is submitted as its own packet pointing back at the item.
+// An instanced item stands for a run of the instance buffer instead, and its
+// matrices are unused.
+//=============================================================================
+
+struct DrawItem
+{
+    glm::mat4 mModelMatrix;
+    glm::mat3 mNormalMatrix;
+    float mShininess;
+    float mDiffuseScale;
+    float mSpecularScale;
+    uint32_t mFirstInstance;
+    uint32_t mInstanceCount;    // 0 for a single, non instanced draw
+};
+
+//=============================================================================
+// Items and packets built by one submit job. Packets index the list's own
+// items until the lists are merged into the render queue.
+//=============================================================================
+
+struct DrawList
+{
+    void Clear() { mItems.clear(); mPackets.clear(); mCulledObjects = 0; mCulledMeshes = 0; mOccludedObjects = 0; }
+
+    std::vector<DrawItem> mItems;
+    std::vector<DrawPacket> mPackets;
+    uint32_t mCulledObjects = 0;
+    uint32_t mCulledMeshes = 0;
+    uint32_t mOccludedObjects = 0;
+};
+
+//=============================================================================
+
+struct DrawMesh
+{
+    Mesh* mMesh;
+    uint32_t mMaterial;     // meshes with the same textures share a material id
+    GeometryRange mGeometry;    // where the mesh sits in GameState::mGeometry
+};
+
+//=============================================================================
+
+struct MeshRange
+{
+    uint32_t mFirst;        // into GameState::mDrawMeshes
+    uint32_t mCount;
+};
+
+//=============================================================================
+
+struct RenderStats
+{
+    uint32_t mDraws;
+    uint32_t mInstances;        // objects drawn, counting every instance
+    uint32_t mProgramBinds;
+    uint32_t mMaterialBinds;
+    uint32_t mMeshBinds;
+    uint32_t mItemBinds;
+};
+
+//=============================================================================
+// What the render thread reports back about a frame it drew.
+//=============================================================================
+
+struct FrameResults
+{
+    RenderStats mRender;
+    GLStateStats mGL;       // bind calls issued and filtered
+    size_t mStreamUsed;
+    size_t mStreamSize;
+    uint32_t mStreamWaits;
+    uint32_t mQueriesIssued;
+    uint32_t mQueriesPending;   // still in flight after the frame
+};
+
+//=============================================================================
+// Hardware occlusion queries go out as world boxes of props and come back,
+// a frame or more later, as answers by prop handle.
+//=============================================================================
+
+struct OcclusionQueryBox
+{
+    PropHandle mProp;
+    glm::vec3 mMin;
+    glm::vec3 mMax;
+};
+
+struct OcclusionQueryResult
+{
+    PropHandle mProp;
+    bool mVisible;
+};
+
+//=============================================================================
+// Everything the render thread needs to draw a frame, built on the main
+// thread from the simulation state. Once published it is read only, apart
+// from mResults and mQueryResults, which the render thread fills in when the
+// frame is done.
+// Instance numbers in mDrawItems count from the start of mInstances. With
+// mGpuCull a prop item's count is its model's prop count, and the GPU draws
+// the visible ones.
+//=============================================================================
+
+struct FrameSnapshot
+{
+    CameraBlock mCamera;
+    LightBlock mLights;
+    std::vector<glm::vec4> mInstances;      // visible props, grouped by model; every prop with mGpuCull
+    std::vector<DrawItem> mDrawItems;
+    RenderQueue mRenderQueue;               // sorted
+    glm::ivec2 mFramebufferSize;
+    bool mMultiDraw;
+    bool mGpuCull;                          // props are culled by GpuCulling, needs mMultiDraw
+    GpuCullParams mCullParams;              // with mGpuCull, all but the pyramid part
+    std::vector<OcclusionQueryBox> mQueryBoxes;         // to query after the frame is drawn
+    std::vector<OcclusionQueryResult> mQueryResults;    // answers that came back while drawing it
+    FrameResults mResults{};
 };
 
 //=============================================================================
@@ -100,15 +367,64 @@ struct GameState
     };
 
     GLFWwindow* mWindow;
+    glm::ivec2 mFramebufferSize;
     glm::mat4 mViewMatrix;
     glm::mat4 mCameraMatrix;
     glm::mat4 mProjectionMatrix;
-    std::vector<std::shared_ptr<Object>> mObjects;
-    std::vector<std::shared_ptr<Light>> mLights;
+    World mWorld;
+    Entity mCamera;
+    ObjectPool<Model> mModels;
+    ObjectPool<Shader> mShaders;
+    JobSystem mJobs;
+    PropSystem mProps{ FLOOR_HALF_SIZE, PROP_COLLISION_DIST };
+    std::vector<ModelHandle> mPropModels;
+    RenderProgram mPrograms[RENDER_PROGRAM_COUNT];
+    size_t mUniformBufferAlign;             // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    bool mMultiDrawSupported;               // GL 4.3 context
+    bool mMultiDraw;                        // draw from mGeometry, instanced runs with glMultiDrawElementsIndirect
+    bool mMultiDrawKey;
+    bool mQueries;                          // hardware occlusion queries hide props
+    bool mQueriesKey;
+    bool mGpuCullSupported;                 // GL 4.3 context with compute shaders
+    bool mGpuCull;                          // props culled in compute shaders, with multi draw only
+    bool mGpuCullKey;
+    std::vector<DrawMesh> mDrawMeshes;
+    std::vector<MeshRange> mModelMeshes;    // by model handle index
+    std::vector<DrawList> mDrawLists;       // one per SUBMIT_GRAIN renderables, filled in parallel
+    DrawList mPropDrawList;
+    Frustum mViewFrustum;                   // of the frame being built
+    OcclusionBuffer mOcclusion{ OCCLUSION_WIDTH, OCCLUSION_HEIGHT };
+    uint32_t mCulledObjects;                // by the last frame built
+    uint32_t mCulledMeshes;
+    uint32_t mOccludedObjects;
+    uint32_t mLitProps;                     // prop and light pairs within the light's radius, a stat for the title
+    uint32_t mAimedProp;                    // prop index under the crosshair, ~0u for none
+
+    // frames go from the main thread to the render thread through here
+    FramePipeline<FrameSnapshot> mFrames;
+    std::thread mRenderThread;
+    FrameResults mLastResults;              // of the last frame drawn, for the title
+
+    // owned by the render thread once it runs
+    StreamBuffer mStream;                   // this frame's instances and indirect commands
+    GeometryArena mGeometry;                // every mesh, for multi draw indirect
+    size_t mIndirectOffset;                 // of this frame's commands in mStream
+    uint32_t mIndirectCount;
+    size_t mStorageBufferAlign;             // GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, and whole instances
+    GpuCulling mGpuCulling;
+    glm::ivec2 mViewportSize;
+    OcclusionQueries<PropHandle> mOcclusionQueries;
+    ShaderHandle mQueryShader;              // draws a query's box, shaders/occlusionquery.vs
+    Uniform<glm::vec3> mQueryBoxMin;
+    Uniform<glm::vec3> mQueryBoxMax;
     uint32_t mButtonMask;
     glm::vec2 mPrevMousePos;
     glm::vec2 mCurMousePos;
     uint32_t mFrame;
+    uint64_t mFrameAllocs;  // heap allocations made by the last frame
+    double mStatsTime;      // when the window title stats were last refreshed
+    uint64_t mTick;         // simulation ticks so far
+    float mInterpolation;   // render blend between the last two sim ticks
     bool mPauseKey;
     bool mPaused;
 };
@@ -119,215 +435,147 @@ static std::shared_ptr<GameState> gGameState;
 
 //=============================================================================
 
-Prop::Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader, float const scale ):
-    mModel( model ),
-    mShader( shader ),
-    mScale( scale ),
-    mOverrideDist( 0.0f ),
-    mUpdateFrame( 0 )
+void ModelUniforms::Resolve( const Shader& shader )
 {
-    mPosXZ.x = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
-    mPosXZ.y = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
-    mVelocityXZ.x = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-    mVelocityXZ.y = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-    mVelocityXZ = glm::normalize( mVelocityXZ );
+    mModel = shader.getUniform<glm::mat4>( "model" );
+    mITModel = shader.getUniform<glm::mat3>( "itModel" );
+    mShininess = shader.getUniform<float>( "shininess" );
+    mDiffuseScale = shader.getUniform<float>( "diffuseScale" );
+    mSpecularScale = shader.getUniform<float>( "specularScale" );
+
+    // the blocks read from fixed binding points, so one bind per frame serves every program
+    shader.bindUniformBlock( "Camera", CAMERA_BLOCK_BINDING );
+    shader.bindUniformBlock( "Lights", LIGHT_BLOCK_BINDING );
 }
 
 //=============================================================================
 
-void Prop::Update( float const deltaTime )
+Entity CreateCamera( const glm::vec3& position, const glm::vec2& pitchYaw )
 {
-    if (gGameState->mPaused)
-        return;
-
-    // If somebody else updated us ignore position update.
-    if (mUpdateFrame != gGameState->mFrame)
-    {
-        // Calc new pos.
-        float const speed = 2.5f;  // meters per second
-        float const dist = deltaTime * speed;
-        glm::vec2 const newPos = mPosXZ + (mVelocityXZ * dist);
-        mOverrideDist = glm::max( mOverrideDist - dist, 0.0f );
-        
-        // Have we hit a wall.
-        bool collision = newPos.x < -FLOOR_HALF_SIZE || newPos.x > FLOOR_HALF_SIZE ||
-                         newPos.y < -FLOOR_HALF_SIZE || newPos.y > FLOOR_HALF_SIZE;
-
-        // If we haven't hit a wall see if we hit anybody else.
-        Prop* prop = nullptr;
-        if (!collision && mOverrideDist == 0.0f)
-        {
-            for (const auto& obj : gGameState->mObjects)
-            {
-                prop = dynamic_cast<Prop*>( obj.get() );
-                if (prop != nullptr && prop != this && prop->mUpdateFrame != gGameState->mFrame)
-                {
-                    collision = length( newPos - prop->mPosXZ ) < 0.5f;
-                    if (collision)
-                    {
-                        mOverrideDist = 0.5f;
-                        break;
-                    }
-                }
-            }
-        }
-
-        if (collision)
-        {
-            mVelocityXZ = -mVelocityXZ;
-            if (prop != nullptr)
-            {
-                prop->mVelocityXZ = -prop->mVelocityXZ;
-                mOverrideDist = 0.5f;
-                mUpdateFrame = gGameState->mFrame;
-            }
-        }
-        else
-        {
-            mPosXZ = newPos;
-        }
-        mUpdateFrame = gGameState->mFrame;
-    }
-
-    glm::mat4 rot = glm::lookAt( glm::vec3( 0.0f, 0.0f, 0.0f ), glm::vec3( -mVelocityXZ.x, 0.0f, -mVelocityXZ.y ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
-    rot = glm::inverse( rot );
-
-    mTransform = glm::mat4( 1.0f );
-    mTransform = glm::translate( mTransform, glm::vec3( mPosXZ.x, 0.0f, mPosXZ.y ) );
-    mTransform *= rot;
-    mTransform = glm::scale( mTransform, glm::vec3( mScale ) );
+    World& world = gGameState->mWorld;
+    Entity const entity = world.Create();
+    world.Add<Transform>( entity, Transform{ position, position, glm::vec3( 1.0f ) } );
+    world.Add<Camera>( entity, Camera{ pitchYaw } );
+    return entity;
 }
 
 //=============================================================================
 
-void Prop::Render()
+Entity CreateFloor( ModelHandle const model )
 {
-    if (mModel != nullptr && mShader != nullptr)
-    {
-        glm::mat3 itModelMatrix( 1.0f );
-        itModelMatrix[0] = normalize( glm::vec3( mTransform[0] ) );
-        itModelMatrix[1] = normalize( glm::vec3( mTransform[1] ) );
-        itModelMatrix[2] = normalize( glm::vec3( mTransform[2] ) );
-
-        mShader->use();
-        mShader->setMat4( "model", mTransform );
-        mShader->setMat3( "itModel", itModelMatrix );
-        mShader->setFloat( "shininess", 100.0f );
-        mShader->setFloat( "diffuseScale", 1.0f );
-        mShader->setFloat( "specularScale", 1.0f );
-        mModel->Draw( *mShader );
-    }
+    World& world = gGameState->mWorld;
+    Entity const entity = world.Create();
+    world.Add<Transform>( entity, Transform{ glm::vec3( 0.0f ), glm::vec3( 0.0f ), glm::vec3( FLOOR_SIZE, 1.0f, FLOOR_SIZE ) } );
+    world.Add<Renderable>( entity, Renderable{ model, 100.0f, 1.0f, 0.0f, true } );
+    return entity;
 }
 
 //=============================================================================
 
-Floor::Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader ):
-    mModel( model ),
-    mShader( shader )
+Entity CreateLight( uint32_t const id, const glm::vec3& color )
 {
-    mTransform = glm::mat4( 1.0f );
-    mTransform = glm::scale( mTransform, glm::vec3( FLOOR_SIZE, 1.0f, FLOOR_SIZE ) );
+    Random rng( RANDOM_SEED, RANDOM_LIGHT_SPAWN, 0, id );
+    glm::vec3 position;
+    glm::vec2 directionXZ;
+    position.x = -FLOOR_HALF_SIZE + ((float)rng.NextBelow( 101 ) / 100.0f * FLOOR_SIZE);
+    position.y = 2.0f;
+    position.z = -FLOOR_HALF_SIZE + ((float)rng.NextBelow( 101 ) / 100.0f * FLOOR_SIZE);
+    directionXZ.x = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+    directionXZ.y = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+    directionXZ = glm::normalize( directionXZ );
+
+    World& world = gGameState->mWorld;
+    Entity const entity = world.Create();
+    world.Add<Transform>( entity, Transform{ position, position, glm::vec3( 1.0f ) } );
+    world.Add<Velocity>( entity, Velocity{ directionXZ, 5.0f } );
+    world.Add<PointLight>( entity, PointLight{ color, 10.0f } );
+    return entity;
 }
 
 //=============================================================================
 
-void Floor::Render()
+void UpdateCameras( float const deltaTime )
 {
-    if (mModel != nullptr && mShader != nullptr)
+    gGameState->mWorld.Each<Camera, Transform>( [deltaTime]( Entity, Camera& camera, Transform& cameraTransform )
     {
-        glm::mat3 itModelMatrix( 1.0f );
-        itModelMatrix[0] = normalize( glm::vec3( mTransform[0] ) );
-        itModelMatrix[1] = normalize( glm::vec3( mTransform[1] ) );
-        itModelMatrix[2] = normalize( glm::vec3( mTransform[2] ) );
-
-        mShader->use();
-        mShader->setMat4( "model", mTransform );
-        mShader->setMat3( "itModel", itModelMatrix );
-        mShader->setFloat( "shininess", 100.0f );
-        mShader->setFloat( "diffuseScale", 1.0f );
-        mShader->setFloat( "specularScale", 0.0f );
-        mModel->Draw( *mShader );
-    }
-}
-
-//=============================================================================
-
-Camera::Camera():
-    mPosition( 0.0f, 13.0f, 23.0f ),
-    mPitchYaw( 0.0f, -28.0f )
-{
+        glm::vec3& position = cameraTransform.mPosition;
+        glm::vec2& pitchYaw = camera.mPitchYaw;
+
+        // Get window size.
+        int wd;
+        int ht;
+        glfwGetWindowSize( gGameState->mWindow, &wd, &ht );
+        glm::vec2 const windowSize = glm::vec2( (float)wd, (float)ht );
+        float const aspectRatio = windowSize.x / windowSize.y;
+
+        // Increment pitch yaw.
+        glm::vec2 const rateOfRotation = glm::vec2( 90.0f * aspectRatio, 90.0f ); // degrees per normalized mouse movement
+        glm::vec2 const normalizedMouseDelta = (gGameState->mCurMousePos - gGameState->mPrevMousePos) / windowSize;
+        glm::vec2 const rotationDelta = -normalizedMouseDelta * rateOfRotation;
+        pitchYaw += rotationDelta;
+        pitchYaw.x = glm::mod( pitchYaw.x, 360.0f );
+        pitchYaw.y = glm::clamp( pitchYaw.y, -90.0f, 90.0f );
+
+        // Calculate orientation.
+        glm::mat4 transform( 1.0f );
+        transform = glm::rotate( transform, glm::radians( pitchYaw.x ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+        transform = glm::rotate( transform, glm::radians( pitchYaw.y ), glm::vec3( 1.0f, 0.0f, 0.0f ) );
+
+        // Update translation.
+        float const speed = 5.0f;  // meters per second
+        position += (gGameState->mButtonMask & GameState::BUTTON_UP) ? -((speed * deltaTime) * glm::vec3( transform[2] )) : glm::vec3( 0.0f );
+        position += (gGameState->mButtonMask & GameState::BUTTON_DOWN) ? ((speed * deltaTime) * glm::vec3( transform[2] )) : glm::vec3( 0.0f );
+        position += (gGameState->mButtonMask & GameState::BUTTON_LEFT) ? -((speed * deltaTime) * glm::vec3( transform[0] )) : glm::vec3( 0.0f );
+        position += (gGameState->mButtonMask & GameState::BUTTON_RIGHT) ? ((speed * deltaTime) * glm::vec3( transform[0] )) : glm::vec3( 0.0f );
+        transform[3] = glm::vec4( position, 1.0f );
+
+        gGameState->mCameraMatrix = transform;
+        gGameState->mViewMatrix = glm::inverse( transform );
+
+        // build projection matrix wd / ht aspect ratio with 45 degree field of view
+        gGameState->mProjectionMatrix = glm::perspective( glm::radians( 45.0f ), windowSize.x / windowSize.y, 0.1f, CAMERA_FAR_PLANE );
+        //gGameState->mProjectionMatrix = glm::ortho( -10 * aspectRatio, 10.0f * aspectRatio, -FLOOR_HALF_SIZE, 10.0f, 0.1f, 100.0f );
+    } );
 }
 
 //=============================================================================
 
-void Camera::Update( float const deltaTime )
+void MoveEntities( float const tickTime )
 {
-    // Get window size.
-    int wd;
-    int ht;
-    glfwGetWindowSize( gGameState->mWindow, &wd, &ht );
-    glm::vec2 const windowSize = glm::vec2( (float)wd, (float)ht );
-    float const aspectRatio = windowSize.x / windowSize.y;
-
-    // Increment pitch yaw.
-    glm::vec2 const rateOfRotation = glm::vec2( 90.0f * aspectRatio, 90.0f ); // degrees per normalized mouse movement
-    glm::vec2 const normalizedMouseDelta = (gGameState->mCurMousePos - gGameState->mPrevMousePos) / windowSize;
-    glm::vec2 const rotationDelta = -normalizedMouseDelta * rateOfRotation;
-    mPitchYaw += rotationDelta;
-    mPitchYaw.x = glm::mod( mPitchYaw.x, 360.0f );
-    mPitchYaw.y = glm::clamp( mPitchYaw.y, -90.0f, 90.0f );
-
-    // Calculate orientation.
-    glm::mat4 transform( 1.0f );
-    transform = glm::rotate( transform, glm::radians( mPitchYaw.x ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
-    transform = glm::rotate( transform, glm::radians( mPitchYaw.y ), glm::vec3( 1.0f, 0.0f, 0.0f ) );
-
-    // Update translation.
-    float const speed = 5.0f;  // meters per second
-    mPosition += (gGameState->mButtonMask & GameState::BUTTON_UP) ? -((speed * deltaTime) * glm::vec3( transform[2] )) : glm::vec3( 0.0f );
-    mPosition += (gGameState->mButtonMask & GameState::BUTTON_DOWN) ? ((speed * deltaTime) * glm::vec3( transform[2] )) : glm::vec3( 0.0f );
-    mPosition += (gGameState->mButtonMask & GameState::BUTTON_LEFT) ? -((speed * deltaTime) * glm::vec3( transform[0] )) : glm::vec3( 0.0f );
-    mPosition += (gGameState->mButtonMask & GameState::BUTTON_RIGHT) ? ((speed * deltaTime) * glm::vec3( transform[0] )) : glm::vec3( 0.0f );
-    transform[3] = glm::vec4( mPosition, 1.0f );
-
-    gGameState->mCameraMatrix = transform;
-    gGameState->mViewMatrix = glm::inverse( transform );
-
-    // build projection matrix wd / ht aspect ratio with 45 degree field of view
-    gGameState->mProjectionMatrix = glm::perspective( glm::radians( 45.0f ), windowSize.x / windowSize.y, 0.1f, 100.0f );
-    //gGameState->mProjectionMatrix = glm::ortho( -10 * aspectRatio, 10.0f * aspectRatio, -FLOOR_HALF_SIZE, 10.0f, 0.1f, 100.0f );
+    // Straight line movement over the floor, bouncing off in a random direction at the walls.
+    uint64_t const tick = gGameState->mTick;
+    gGameState->mWorld.Each<Velocity, Transform>( [tickTime, tick]( Entity const entity, Velocity& velocity, Transform& transform )
+    {
+        glm::vec3& position = transform.mPosition;
+        transform.mPrevPosition = position;
+        position.x += velocity.mDirectionXZ.x * tickTime * velocity.mSpeed;
+        position.z += velocity.mDirectionXZ.y * tickTime * velocity.mSpeed;
+        if (position.x < -FLOOR_HALF_SIZE || position.x > FLOOR_HALF_SIZE ||
+            position.z < -FLOOR_HALF_SIZE || position.z > FLOOR_HALF_SIZE)
+        {
+            Random rng( RANDOM_SEED, RANDOM_BOUNCE, tick, entity.GetIndex() );
+            velocity.mDirectionXZ.x = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+            velocity.mDirectionXZ.y = -1.0f + ((float)rng.NextBelow( 101 ) / 100.0f * 2.0f);
+            velocity.mDirectionXZ = glm::normalize( velocity.mDirectionXZ );
+            position.x = glm::clamp( position.x, -FLOOR_HALF_SIZE, FLOOR_HALF_SIZE );
+            position.z = glm::clamp( position.z, -FLOOR_HALF_SIZE, FLOOR_HALF_SIZE );
+        }
+    } );
 }
 
 //=============================================================================
 
-Light::Light( const glm::vec3& color ):
-    mColor( color ),
-    mRadius( 10.0f )
+glm::vec3 GetRenderPosition( const Transform& transform )
 {
-    mPosXZ.x = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
-    mPosXZ.y = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
-    mVelocityXZ.x = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-    mVelocityXZ.y = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-    mVelocityXZ = glm::normalize( mVelocityXZ );
+    return glm::mix( transform.mPrevPosition, transform.mPosition, gGameState->mInterpolation );
 }
 
 //=============================================================================
 
-void Light::Update( float const deltaTime )
+glm::mat4 GetRenderMatrix( const Transform& transform )
 {
-    if (gGameState->mPaused)
-        return;
-
-    float const speed = 5.0f;  // meters per second
-    mPosXZ += mVelocityXZ * deltaTime * speed;
-    if (mPosXZ.x < -FLOOR_HALF_SIZE || mPosXZ.x > FLOOR_HALF_SIZE ||
-        mPosXZ.y < -FLOOR_HALF_SIZE || mPosXZ.y > FLOOR_HALF_SIZE)
-    {
-        mVelocityXZ.x = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-        mVelocityXZ.y = -1.0f + ((float)(rand() % 101) / 100.0f * 2.0f);
-        mVelocityXZ = glm::normalize( mVelocityXZ );
-        mPosXZ = glm::clamp( mPosXZ, -FLOOR_HALF_SIZE, FLOOR_HALF_SIZE );
-    }
+    // Transforms are translate and scale only, so the normal matrix is identity.
+    return glm::scale( glm::translate( glm::mat4( 1.0f ), GetRenderPosition( transform ) ), transform.mScale );
 }
 
 //=============================================================================
@@ -357,6 +605,28 @@ void ProcessInput()
         gGameState->mPaused = !gGameState->mPaused;
     }
     gGameState->mPauseKey = pauseKey;
+
+    bool const multiDrawKey = glfwGetKey( gGameState->mWindow, GLFW_KEY_M ) == GLFW_PRESS ? true : false;
+    if (!multiDrawKey && gGameState->mMultiDrawKey && gGameState->mMultiDrawSupported)
+    {
+        gGameState->mMultiDraw = !gGameState->mMultiDraw;
+    }
+    gGameState->mMultiDrawKey = multiDrawKey;
+
+    bool const queriesKey = glfwGetKey( gGameState->mWindow, GLFW_KEY_O ) == GLFW_PRESS ? true : false;
+    if (!queriesKey && gGameState->mQueriesKey)
+    {
+        gGameState->mQueries = !gGameState->mQueries;
+        gGameState->mProps.mQueryInterval = gGameState->mQueries ? OCCLUSION_QUERY_INTERVAL : 0;
+    }
+    gGameState->mQueriesKey = queriesKey;
+
+    bool const gpuCullKey = glfwGetKey( gGameState->mWindow, GLFW_KEY_G ) == GLFW_PRESS ? true : false;
+    if (!gpuCullKey && gGameState->mGpuCullKey && gGameState->mGpuCullSupported)
+    {
+        gGameState->mGpuCull = !gGameState->mGpuCull;
+    }
+    gGameState->mGpuCullKey = gpuCullKey;
 }
 
 //=============================================================================
@@ -364,10 +634,10 @@ void ProcessInput()
 void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
 {
     // glfw: whenever the window size changed (by OS or user resize) this callback function executes
-    // make sure the viewport matches the new window dimensions; note that width and 
+    // the render thread makes the viewport match the new size with the next frame; note that width and 
     // height will be significantly larger than specified on retina displays.
     (void)window;
-    glViewport(0, 0, width, height);
+    gGameState->mFramebufferSize = glm::ivec2( width, height );
 }
 
 //=============================================================================
@@ -378,17 +648,23 @@ bool Init()
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // uncomment this statement to fix compilation on OS X
 #endif
 
-    // glfw window creation
+    // glfw window creation, newest context first: 4.4 for persistent mapped buffers,
+    // 4.3 for multi draw indirect, else the lesson's 3.3
     // --------------------
-    gGameState->mWindow = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", nullptr, nullptr);
+    int const versions[][2] = { { 4, 4 }, { 4, 3 }, { 3, 3 } };
+    gGameState->mWindow = nullptr;
+    for (uint32_t i = 0; i < 3 && gGameState->mWindow == nullptr; i++)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, versions[i][0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, versions[i][1]);
+        gGameState->mWindow = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", nullptr, nullptr);
+    }
     if (gGameState->mWindow == nullptr)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -397,6 +673,8 @@ bool Init()
     }
     glfwMakeContextCurrent(gGameState->mWindow);
     glfwSetFramebufferSizeCallback(gGameState->mWindow, FramebufferSizeCallback);
+    glfwGetFramebufferSize(gGameState->mWindow, &gGameState->mFramebufferSize.x, &gGameState->mFramebufferSize.y);
+    gGameState->mViewportSize = glm::ivec2( 0 );
 
     // glad: load all OpenGL function pointers (extensions)
     // ---------------------------------------
@@ -416,10 +694,25 @@ bool Init()
 
     gGameState->mPauseKey = false;
     gGameState->mPaused = false;
+    gGameState->mMultiDrawSupported = GLAD_GL_VERSION_4_3 != 0;
+    gGameState->mMultiDraw = gGameState->mMultiDrawSupported;
+    gGameState->mMultiDrawKey = false;
+    gGameState->mQueries = false;
+    gGameState->mQueriesKey = false;
+    gGameState->mGpuCullSupported = GpuCulling::IsSupported();
+    gGameState->mGpuCull = gGameState->mGpuCullSupported;
+    gGameState->mGpuCullKey = false;
+    gGameState->mCulledObjects = 0;
+    gGameState->mCulledMeshes = 0;
+    gGameState->mOccludedObjects = 0;
+    gGameState->mLitProps = 0;
+    gGameState->mAimedProp = ~0u;
 
     gGameState->mFrame = 1;
-
-    srand( (uint32_t)(glfwGetTime() * 10000) );
+    gGameState->mFrameAllocs = 0;
+    gGameState->mStatsTime = glfwGetTime();
+    gGameState->mTick = 0;
+    gGameState->mInterpolation = 1.0f;
 
     return true;
 }
@@ -436,64 +729,749 @@ void Update( float const deltaTime )
     // process input
     ProcessInput();
 
-    // update objects
-    for (const auto& obj : gGameState->mObjects)
+    // update cameras
+    UpdateCameras( deltaTime );
+}
+
+//=============================================================================
+
+void Simulate( float const tickTime )
+{
+    // advance the simulation by one fixed tick
+    MoveEntities( tickTime );
+
+    // props far from or outside the view step less often
+    gGameState->mProps.SetLodView( glm::vec3( gGameState->mCameraMatrix[3] ), gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+    gGameState->mProps.Update( tickTime, gGameState->mJobs );
+    gGameState->mTick++;
+}
+
+//=============================================================================
+
+void SnapshotFrameBlocks( FrameSnapshot& frame )
+{
+    // Unused lights get no color and a radius that keeps the attenuation finite.
+    CameraBlock& camera = frame.mCamera;
+    camera.mView = gGameState->mViewMatrix;
+    camera.mProjection = gGameState->mProjectionMatrix;
+    camera.mCameraPos = gGameState->mCameraMatrix[3];
+
+    // The props each light reaches come from the prop tree, not a walk over all props. They
+    // are only counted for the title; shading still takes every light.
+    LightBlock& lights = frame.mLights;
+    uint32_t i = 0;
+    uint32_t litProps = 0;
+    gGameState->mWorld.Each<PointLight, Transform>( [&]( Entity, const PointLight& light, const Transform& transform )
     {
-        obj->Update( deltaTime );
+        if (i < MAX_LIGHTS)
+        {
+            glm::vec3 const position = GetRenderPosition( transform );
+            lights.mPositionRadius[i] = glm::vec4( position, light.mRadius );
+            lights.mColor[i] = glm::vec4( light.mColor, 0.0f );
+            gGameState->mProps.QuerySphere( position, light.mRadius, [&litProps]( uint32_t ) { litProps++; } );
+            i++;
+        }
+    } );
+    gGameState->mLitProps = litProps;
+    for (; i < MAX_LIGHTS; i++)
+    {
+        lights.mPositionRadius[i] = glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f );
+        lights.mColor[i] = glm::vec4( 0.0f );
     }
 }
 
 //=============================================================================
 
-void PrepareShader( const std::shared_ptr<Shader>& shader )
+bool WriteFrameBlocks( const FrameSnapshot& frame )
 {
-    shader->use();
+    // Camera and light state go once per frame into the stream buffer, bound by range.
+    StreamBuffer& stream = gGameState->mStream;
+    GLuint const buffer = stream.GetBuffer();
+    size_t const align = gGameState->mUniformBufferAlign;
+
+    StreamAlloc const camera = stream.Alloc( sizeof( CameraBlock ), align );
+    StreamAlloc const lights = stream.Alloc( sizeof( LightBlock ), align );
+    if (camera.mData == nullptr || lights.mData == nullptr)
+        return false;
+    *static_cast<CameraBlock*>( camera.mData ) = frame.mCamera;
+    *static_cast<LightBlock*>( lights.mData ) = frame.mLights;
+    glBindBufferRange( GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, buffer, (GLintptr)camera.mOffset, sizeof( CameraBlock ) );
+    glBindBufferRange( GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, buffer, (GLintptr)lights.mOffset, sizeof( LightBlock ) );
+    return true;
+}
+
+//=============================================================================
+
+bool WriteInstances( const FrameSnapshot& frame, uint32_t& instanceBase )
+{
+    // Instance numbers count from the start of the stream buffer, where the instance attribute
+    // points, so the snapshot's numbers move up by where its instances land.
+    instanceBase = 0;
+    if (frame.mInstances.empty())
+        return true;
+    size_t const size = sizeof( glm::vec4 ) * frame.mInstances.size();
+    StreamAlloc const alloc = gGameState->mStream.Alloc( size, gGameState->mStorageBufferAlign );
+    if (alloc.mData == nullptr)
+        return false;
+    memcpy( alloc.mData, frame.mInstances.data(), size );
+    instanceBase = (uint32_t)(alloc.mOffset / sizeof( glm::vec4 ));
+    return true;
+}
+
+//=============================================================================
+
+void RegisterModelMeshes( ModelHandle const handle, std::map<std::vector<unsigned int>, uint32_t>& materialIds )
+{
+    // Give every mesh of the model a draw mesh index, and a material id shared by all meshes using the same textures.
+    Model* const model = gGameState->mModels.Get( handle );
+    if (model == nullptr)
+        return;
+
+    uint32_t const index = handle.GetIndex();
+    if (index >= gGameState->mModelMeshes.size())
+    {
+        gGameState->mModelMeshes.resize( index + 1, MeshRange{ 0, 0 } );
+    }
+    gGameState->mModelMeshes[index] = MeshRange{ (uint32_t)gGameState->mDrawMeshes.size(), (uint32_t)model->meshes.size() };
+    for (Mesh& mesh : model->meshes)
+    {
+        std::vector<unsigned int> textureIds;
+        for (const Texture& texture : mesh.textures)
+        {
+            textureIds.push_back( texture.id );
+        }
+        auto const found = materialIds.insert( std::make_pair( textureIds, (uint32_t)materialIds.size() ) );
+        GeometryRange const geometry = gGameState->mMultiDrawSupported ? gGameState->mGeometry.Add( mesh ) : GeometryRange{ 0, 0, 0 };
+        gGameState->mDrawMeshes.push_back( DrawMesh{ &mesh, found.first->second, geometry } );
+    }
+}
+
+//=============================================================================
+
+void SubmitModel( DrawList& list, uint32_t const program, ModelHandle const model, const DrawItem& item, const glm::vec3& position )
+{
+    // Depth across the view range, so nearer draws of the same state go first.
+    // Only reads shared state, so submit jobs can run this on their own lists.
+    uint32_t const index = model.GetIndex();
+    if (!gGameState->mModels.IsValid( model ) || index >= gGameState->mModelMeshes.size())
+        return;
+
+    glm::vec3 const cameraPos = glm::vec3( gGameState->mCameraMatrix[3] );
+    glm::vec3 const cameraForward = -glm::vec3( gGameState->mCameraMatrix[2] );
+    float const depth01 = glm::dot( position - cameraPos, cameraForward ) / CAMERA_FAR_PLANE;
+
+    // A single object is culled as a whole by its model's box, against the view and then the
+    // occluders, and after that mesh by mesh. An instanced item's props have already been culled
+    // one by one.
+    bool const single = item.mInstanceCount == 0;
+    const Frustum& frustum = gGameState->mViewFrustum;
+    if (single)
+    {
+        Bounds const bounds = gGameState->mModels.Get( model )->bounds.Transformed( item.mModelMatrix );
+        if (!frustum.IntersectsBox( bounds.mMin, bounds.mMax ))
+        {
+            list.mCulledObjects++;
+            return;
+        }
+        if (!gGameState->mOcclusion.IsVisible( bounds.mMin, bounds.mMax ))
+        {
+            list.mOccludedObjects++;
+            return;
+        }
+    }
+
+    uint32_t const itemIndex = (uint32_t)list.mItems.size();
+    list.mItems.push_back( item );
+    const MeshRange& meshes = gGameState->mModelMeshes[index];
+    for (uint32_t m = meshes.mFirst; m < meshes.mFirst + meshes.mCount; m++)
+    {
+        if (single && meshes.mCount > 1)
+        {
+            Bounds const bounds = gGameState->mDrawMeshes[m].mMesh->bounds.Transformed( item.mModelMatrix );
+            if (!frustum.IntersectsBox( bounds.mMin, bounds.mMax ))
+            {
+                list.mCulledMeshes++;
+                continue;
+            }
+        }
+        uint64_t const key = RenderQueue::MakeKey( RENDER_PASS_OPAQUE, program, gGameState->mDrawMeshes[m].mMaterial, m, depth01 );
+        list.mPackets.push_back( DrawPacket{ key, itemIndex, m } );
+    }
+}
+
+//=============================================================================
+
+uint32_t SubmitEntities()
+{
+    // Every SUBMIT_GRAIN renderables fill their own draw list, in parallel; returns the list count.
+    World& world = gGameState->mWorld;
+    ComponentStore<Renderable>& renderables = world.GetStore<Renderable>();
+    uint32_t const count = renderables.GetCount();
+    uint32_t const numLists = (count + SUBMIT_GRAIN - 1) / SUBMIT_GRAIN;
+    if (gGameState->mDrawLists.size() < numLists)
+    {
+        gGameState->mDrawLists.resize( numLists );
+    }
+    for (uint32_t l = 0; l < numLists; l++)
+    {
+        gGameState->mDrawLists[l].Clear();
+    }
 
-    // Set projection and view matrix.
-    shader->setMat4( "projection", gGameState->mProjectionMatrix );
-    shader->setMat4( "view", gGameState->mViewMatrix );
+    // A call may get several lists' worth of renderables; each goes to its own list.
+    gGameState->mJobs.ParallelFor( 0, count, SUBMIT_GRAIN, [&world, &renderables]( uint32_t const begin, uint32_t const end )
+    {
+        const Renderable* const data = renderables.GetData();
+        const Entity* const entities = renderables.GetEntities();
+        for (uint32_t i = begin; i < end; i++)
+        {
+            DrawList& list = gGameState->mDrawLists[i / SUBMIT_GRAIN];
+            const Transform* const transform = world.GetStore<Transform>().Get( entities[i] );
+            if (transform == nullptr)
+                continue;
+
+            const Renderable& renderable = data[i];
+            glm::vec3 const position = GetRenderPosition( *transform );
+            DrawItem const item = { GetRenderMatrix( *transform ), glm::mat3( 1.0f ), renderable.mShininess, renderable.mDiffuseScale, renderable.mSpecularScale, 0, 0 };
+            SubmitModel( list, RENDER_PROGRAM_MODEL, renderable.mModel, item, position );
+        }
+    } );
+    return numLists;
+}
+
+//=============================================================================
+
+void SubmitProps( DrawList& list, std::vector<glm::vec4>& instances )
+{
+    // Props sharing a model are drawn together: one instanced draw per mesh of the model.
+    PropSystem& props = gGameState->mProps;
+    uint32_t const numModels = (uint32_t)gGameState->mPropModels.size();
+    list.Clear();
+    instances.clear();
+    if (props.GetCount() == 0)
+        return;
 
-    // Set camera position.
-    shader->setVec3( "cameraPos", gGameState->mCameraMatrix[3] );
+    // pack each prop into a vec4 at the interpolated position between the last two ticks, test its
+    // model's bounding sphere against the view and its box against the occluders, and count the
+    // visible ones per model, in parallel. Culled on the GPU, every prop is packed and none tested.
+    bool const gpuCull = gGameState->mGpuCull && gGameState->mMultiDraw;
+    props.BuildInstances( gGameState->mInterpolation, gpuCull ? nullptr : &gGameState->mViewFrustum, gpuCull ? nullptr : &gGameState->mOcclusion, numModels, gGameState->mJobs );
+    list.mOccludedObjects = props.GetOccludedCount();
+    list.mCulledObjects = props.GetCount() - props.GetInstanceFirst( numModels ) - list.mOccludedObjects;
 
-    // Set lighting state.
-    char nameStr[64];
-    for (uint32_t i = 0; i < gGameState->mLights.size(); i++)
+    // scatter them grouped by model into the frame's instances, in parallel
+    instances.resize( props.GetInstanceFirst( numModels ) );
+    props.WriteInstances( instances.data(), gGameState->mJobs );
+
+    for (uint32_t m = 0; m < numModels; m++)
     {
-        sprintf( nameStr, "lightPositions[%d]", i );
-        shader->setVec3( nameStr, glm::vec3( gGameState->mLights[i]->mPosXZ.x, 2.0f, gGameState->mLights[i]->mPosXZ.y ) );
-        sprintf( nameStr, "lightColors[%d]", i );
-        shader->setVec3( nameStr, gGameState->mLights[i]->mColor );
-        sprintf( nameStr, "lightRadii[%d]", i );
-        shader->setFloat( nameStr, gGameState->mLights[i]->mRadius );
+        uint32_t const first = props.GetInstanceFirst( m );
+        uint32_t const count = props.GetInstanceFirst( m + 1 ) - first;
+        if (count == 0)
+            continue;
+        DrawItem const item = { glm::mat4( 1.0f ), glm::mat3( 1.0f ), 100.0f, 1.0f, 1.0f, first, count };
+        SubmitModel( list, RENDER_PROGRAM_INSTANCED, gGameState->mPropModels[m], item, glm::vec3( gGameState->mCameraMatrix[3] ) );
     }
+}
 
+//=============================================================================
+
+void SnapshotCullParams( FrameSnapshot& frame )
+{
+    // What the compute pass needs besides the instances: this frame's view, and where each
+    // prop model's instances are and what bounds them. The pyramid part is the render thread's.
+    PropSystem& props = gGameState->mProps;
+    GpuCullParams& params = frame.mCullParams;
+    uint32_t const numModels = (uint32_t)gGameState->mPropModels.size();
+    for (uint32_t p = 0; p < 6; p++)
+    {
+        params.mPlanes[p] = gGameState->mViewFrustum.mPlanes[p];
+    }
+    for (uint32_t m = 0; m < numModels; m++)
+    {
+        const Bounds& bounds = gGameState->mModels.Get( gGameState->mPropModels[m] )->bounds;
+        params.mModelSpheres[m] = glm::vec4( bounds.mCenter, bounds.mRadius );
+    }
+    for (uint32_t m = 0; m <= numModels; m++)
+    {
+        params.mModelFirst[m] = props.GetCount() > 0 ? props.GetInstanceFirst( m ) : 0;
+    }
+    params.mInstanceCount = params.mModelFirst[numModels];
+    params.mModelCount = numModels;
+}
+
+//=============================================================================
+
+void MergeDrawLists( uint32_t const numEntityLists, FrameSnapshot& frame )
+{
+    // Lists go in a fixed order, so the merged queue is the same whatever ran where.
+    frame.mRenderQueue.Clear();
+    frame.mDrawItems.clear();
+    gGameState->mCulledObjects = 0;
+    gGameState->mCulledMeshes = 0;
+    gGameState->mOccludedObjects = 0;
+    for (uint32_t i = 0; i <= numEntityLists; i++)
+    {
+        const DrawList& list = i < numEntityLists ? gGameState->mDrawLists[i] : gGameState->mPropDrawList;
+        gGameState->mCulledObjects += list.mCulledObjects;
+        gGameState->mCulledMeshes += list.mCulledMeshes;
+        gGameState->mOccludedObjects += list.mOccludedObjects;
+        uint32_t const itemBase = (uint32_t)frame.mDrawItems.size();
+        frame.mDrawItems.insert( frame.mDrawItems.end(), list.mItems.begin(), list.mItems.end() );
+        frame.mRenderQueue.Append( list.mPackets.data(), (uint32_t)list.mPackets.size(), itemBase );
+    }
 }
 
 //=============================================================================
 
-void Render( const std::shared_ptr<Shader>& shader )
+void SubmitQueries( FrameSnapshot& frame )
 {
+    // The props BuildInstances picked get a box query each, drawn after the frame.
+    PropSystem& props = gGameState->mProps;
+    frame.mQueryBoxes.clear();
+    for (uint32_t n = 0; n < props.GetQueryCount(); n++)
+    {
+        uint32_t const index = props.GetQueryProp( n );
+        OcclusionQueryBox box;
+        box.mProp = props.GetHandle( index );
+        props.GetInstanceBox( index, box.mMin, box.mMax );
+        frame.mQueryBoxes.push_back( box );
+    }
+}
+
+//=============================================================================
+
+void ApplyQueryResults( const FrameSnapshot& frame )
+{
+    // Answers still arriving after queries were switched off are dropped.
+    if (!gGameState->mQueries)
+        return;
+    for (const OcclusionQueryResult& result : frame.mQueryResults)
+    {
+        gGameState->mProps.SetQueryResult( result.mProp, result.mVisible );
+    }
+}
+
+//=============================================================================
+
+void DrawOccluders()
+{
+    // The occluder entities and the props nearest the camera go into the software depth
+    // buffer as boxes; everything submitted afterwards is tested against it.
+    OcclusionBuffer& occlusion = gGameState->mOcclusion;
+    World& world = gGameState->mWorld;
+    occlusion.Begin( gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+    world.Each<Renderable, Transform>( [&occlusion]( Entity, const Renderable& renderable, const Transform& transform )
+    {
+        const Model* const model = gGameState->mModels.Get( renderable.mModel );
+        if (renderable.mOccluder && model != nullptr)
+        {
+            occlusion.DrawBox( GetRenderMatrix( transform ), model->bounds.mMin, model->bounds.mMax );
+        }
+    } );
+    glm::vec3 const cameraPos = glm::vec3( gGameState->mCameraMatrix[3] );
+    gGameState->mProps.DrawOccluders( occlusion, cameraPos, gGameState->mInterpolation, OCCLUDER_PROP_DISTANCE, OCCLUDER_PROP_COUNT );
+    occlusion.End();
+}
+
+//=============================================================================
+
+void PickProp()
+{
+    // The cursor is captured, so what the player points at is the middle of the screen.
+    glm::vec3 const cameraPos = glm::vec3( gGameState->mCameraMatrix[3] );
+    glm::vec3 const cameraForward = -glm::vec3( gGameState->mCameraMatrix[2] );
+    gGameState->mAimedProp = gGameState->mProps.RayCast( cameraPos, cameraForward, CAMERA_FAR_PLANE );
+}
+
+//=============================================================================
+
+void BuildFrame( FrameSnapshot& frame )
+{
+    // Collect everything the frame draws from the simulation state; the render thread
+    // takes it from here. Runs on the main thread and its job workers.
+    gGameState->mViewFrustum = Frustum( gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+    DrawOccluders();
+    SnapshotFrameBlocks( frame );
+    PickProp();
+    uint32_t const numEntityLists = SubmitEntities();
+    SubmitProps( gGameState->mPropDrawList, frame.mInstances );
+    SubmitQueries( frame );
+    MergeDrawLists( numEntityLists, frame );
+    frame.mRenderQueue.Sort();
+    frame.mFramebufferSize = gGameState->mFramebufferSize;
+    frame.mMultiDraw = gGameState->mMultiDraw;
+    frame.mGpuCull = gGameState->mGpuCull && gGameState->mMultiDraw;
+    if (frame.mGpuCull)
+    {
+        SnapshotCullParams( frame );
+    }
+}
+
+//=============================================================================
+
+bool BuildIndirectCommands( const FrameSnapshot& frame, uint32_t const instanceBase )
+{
+    // One command per instanced packet, in queue order, written straight into the
+    // stream buffer. The executor walks the packets in the same order, so a run of
+    // packets is a run of commands.
+    const DrawPacket* const packets = frame.mRenderQueue.GetPackets();
+    uint32_t const count = frame.mRenderQueue.GetCount();
+    uint32_t numCommands = 0;
+    for (uint32_t p = 0; p < count; p++)
+    {
+        numCommands += frame.mDrawItems[packets[p].mItem].mInstanceCount > 0 ? 1 : 0;
+    }
+    StreamAlloc const alloc = gGameState->mStream.Alloc( sizeof( DrawElementsIndirectCommand ) * numCommands, gGameState->mStorageBufferAlign );
+    if (alloc.mData == nullptr)
+        return false;
+
+    DrawElementsIndirectCommand* command = static_cast<DrawElementsIndirectCommand*>( alloc.mData );
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const DrawItem& item = frame.mDrawItems[packets[p].mItem];
+        if (item.mInstanceCount == 0)
+            continue;
+        const GeometryRange& range = gGameState->mDrawMeshes[packets[p].mMesh].mGeometry;
+        *command++ = DrawElementsIndirectCommand{ range.mIndexCount, item.mInstanceCount, range.mFirstIndex, range.mBaseVertex, instanceBase + item.mFirstInstance };
+    }
+    gGameState->mIndirectOffset = alloc.mOffset;
+    gGameState->mIndirectCount = numCommands;
+    return true;
+}
+
+//=============================================================================
+
+bool WriteCullBuffers( const FrameSnapshot& frame, uint32_t const instanceBase, GpuCullRanges& ranges, uint32_t& visibleBase )
+{
+    // The compute pass reads every prop from where WriteInstances put them and packs the
+    // visible ones into a range as large, which the draws then read instead.
+    StreamBuffer& stream = gGameState->mStream;
+    size_t const align = gGameState->mStorageBufferAlign;
+    size_t const instancesSize = sizeof( glm::vec4 ) * frame.mInstances.size();
+    StreamAlloc const params = stream.Alloc( sizeof( GpuCullParams ), align );
+    StreamAlloc const visible = stream.Alloc( instancesSize, align );
+    StreamAlloc const counts = stream.Alloc( sizeof( uint32_t ) * GpuCullParams::MAX_MODELS, align );
+    if (params.mData == nullptr || visible.mData == nullptr || counts.mData == nullptr)
+        return false;
+    GpuCullParams* const out = static_cast<GpuCullParams*>( params.mData );
+    *out = frame.mCullParams;
+    gGameState->mGpuCulling.FillParams( *out );
+    memset( counts.mData, 0, sizeof( uint32_t ) * GpuCullParams::MAX_MODELS );
+
+    ranges.mParams = params.mOffset;
+    ranges.mInstances = sizeof( glm::vec4 ) * instanceBase;
+    ranges.mVisible = visible.mOffset;
+    ranges.mCounts = counts.mOffset;
+    visibleBase = (uint32_t)(visible.mOffset / sizeof( glm::vec4 ));
+    return true;
+}
+
+//=============================================================================
+
+bool WriteCommandModels( const FrameSnapshot& frame, GpuCullRanges& ranges )
+{
+    // Next to each indirect command, the prop model whose visible count it draws: the one
+    // whose instance range holds the item's first instance. Models without props have an
+    // empty range, which no item can fall into.
+    StreamAlloc const alloc = gGameState->mStream.Alloc( sizeof( uint32_t ) * gGameState->mIndirectCount, gGameState->mStorageBufferAlign );
+    if (alloc.mData == nullptr)
+        return false;
+
+    const GpuCullParams& params = frame.mCullParams;
+    const DrawPacket* const packets = frame.mRenderQueue.GetPackets();
+    uint32_t const count = frame.mRenderQueue.GetCount();
+    uint32_t* model = static_cast<uint32_t*>( alloc.mData );
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const DrawItem& item = frame.mDrawItems[packets[p].mItem];
+        if (item.mInstanceCount == 0)
+            continue;
+        uint32_t m = 0;
+        while (m < params.mModelCount && !(params.mModelFirst[m] <= item.mFirstInstance && item.mFirstInstance < params.mModelFirst[m + 1]))
+        {
+            m++;
+        }
+        *model++ = m < params.mModelCount ? m : ~0u;
+    }
+    ranges.mCommands = gGameState->mIndirectOffset;
+    ranges.mCommandModels = alloc.mOffset;
+    return true;
+}
+
+//=============================================================================
+
+void ExecuteRenderQueue( const FrameSnapshot& frame, bool const multiDraw, uint32_t const instanceBase, RenderStats& stats )
+{
+    // Packets arrive sorted by state, so each bind only happens when its part of the key changes.
+    // With multi draw every mesh lives in the geometry arena: there is one VAO, and a run of
+    // instanced packets sharing program, material and material scalars is a single indirect call.
+    stats = RenderStats{ 0, 0, 0, 0, 0, 0 };
+
+    // commands are built before the stream buffer is flushed, see RenderFrame
+    GLuint const streamBuffer = gGameState->mStream.GetBuffer();
+    if (multiDraw)
+    {
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, streamBuffer );
+        gGameState->mGeometry.AttachInstances( streamBuffer, INSTANCE_ATTRIBUTE );
+    }
+
+    const DrawPacket* const packets = frame.mRenderQueue.GetPackets();
+    uint32_t const count = frame.mRenderQueue.GetCount();
+    const Shader* shader = nullptr;
+    const ModelUniforms* uniforms = nullptr;
+    uint32_t program = ~0u;
+    uint32_t material = ~0u;
+    uint32_t mesh = ~0u;
+    uint32_t item = ~0u;
+    uint32_t command = 0;
+    float shininess = -1.0f;
+    float diffuseScale = -1.0f;
+    float specularScale = -1.0f;
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const DrawPacket& packet = packets[p];
+        const DrawMesh& drawMesh = gGameState->mDrawMeshes[packet.mMesh];
+        if (RenderQueue::GetProgram( packet.mKey ) != program)
+        {
+            // a new program starts with none of its per draw uniforms set
+            program = RenderQueue::GetProgram( packet.mKey );
+            shader = gGameState->mShaders.Get( gGameState->mPrograms[program].mShader );
+            uniforms = &gGameState->mPrograms[program].mUniforms;
+            if (shader != nullptr)
+            {
+                shader->use();
+            }
+            material = ~0u;
+            item = ~0u;
+            shininess = diffuseScale = specularScale = -1.0f;
+            stats.mProgramBinds++;
+        }
+        const DrawItem& drawItem = frame.mDrawItems[packet.mItem];
+        if (shader == nullptr)
+        {
+            command += drawItem.mInstanceCount > 0 ? 1 : 0;
+            continue;
+        }
+        if (RenderQueue::GetMaterial( packet.mKey ) != material)
+        {
+            material = RenderQueue::GetMaterial( packet.mKey );
+            drawMesh.mMesh->BindTextures( *shader );
+            stats.mMaterialBinds++;
+        }
+        if (packet.mMesh != mesh && !multiDraw)
+        {
+            mesh = packet.mMesh;
+            drawMesh.mMesh->BindGeometry();
+            stats.mMeshBinds++;
+        }
+        if (packet.mItem != item)
+        {
+            item = packet.mItem;
+            if (drawItem.mInstanceCount == 0)
+            {
+                shader->set( uniforms->mModel, drawItem.mModelMatrix );
+                shader->set( uniforms->mITModel, drawItem.mNormalMatrix );
+            }
+            if (drawItem.mShininess != shininess || drawItem.mDiffuseScale != diffuseScale || drawItem.mSpecularScale != specularScale)
+            {
+                shininess = drawItem.mShininess;
+                diffuseScale = drawItem.mDiffuseScale;
+                specularScale = drawItem.mSpecularScale;
+                shader->set( uniforms->mShininess, shininess );
+                shader->set( uniforms->mDiffuseScale, diffuseScale );
+                shader->set( uniforms->mSpecularScale, specularScale );
+            }
+            stats.mItemBinds++;
+        }
+
+        if (multiDraw && drawItem.mInstanceCount > 0)
+        {
+            // extend the run while nothing that needs a bind or a uniform changes
+            uint32_t end = p + 1;
+            stats.mInstances += drawItem.mInstanceCount;
+            for (; end < count; end++)
+            {
+                const DrawItem& next = frame.mDrawItems[packets[end].mItem];
+                if (RenderQueue::GetProgram( packets[end].mKey ) != program || RenderQueue::GetMaterial( packets[end].mKey ) != material ||
+                    next.mInstanceCount == 0 || next.mShininess != shininess || next.mDiffuseScale != diffuseScale || next.mSpecularScale != specularScale)
+                    break;
+                stats.mInstances += next.mInstanceCount;
+            }
+            size_t const offset = gGameState->mIndirectOffset + sizeof( DrawElementsIndirectCommand ) * command;
+            glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, (GLsizei)(end - p), 0 );
+            command += end - p;
+            item = packets[end - 1].mItem;
+            p = end - 1;
+        }
+        else if (multiDraw)
+        {
+            const GeometryRange& range = drawMesh.mGeometry;
+            glDrawElementsBaseVertex( GL_TRIANGLES, (GLsizei)range.mIndexCount, GL_UNSIGNED_INT, (void*)(sizeof( unsigned int ) * range.mFirstIndex), range.mBaseVertex );
+            stats.mInstances++;
+        }
+        else if (drawItem.mInstanceCount > 0)
+        {
+            drawMesh.mMesh->BindInstances( streamBuffer, INSTANCE_ATTRIBUTE, sizeof( glm::vec4 ) * (instanceBase + drawItem.mFirstInstance) );
+            drawMesh.mMesh->DrawElementsInstanced( (GLsizei)drawItem.mInstanceCount );
+            stats.mInstances += drawItem.mInstanceCount;
+        }
+        else
+        {
+            drawMesh.mMesh->DrawElements();
+            stats.mInstances++;
+        }
+        stats.mDraws++;
+    }
+}
+
+//=============================================================================
+
+uint32_t IssueOcclusionQueries( const FrameSnapshot& frame )
+{
+    // Boxes test against the depth of the frame just drawn and write nothing; what
+    // doesn't fit in the ring of queries in flight waits for the next frame's list.
+    const Shader* const shader = gGameState->mShaders.Get( gGameState->mQueryShader );
+    if (frame.mQueryBoxes.empty() || shader == nullptr)
+        return 0;
+
+    OcclusionQueries<PropHandle>& queries = gGameState->mOcclusionQueries;
+    shader->use();
+    queries.BindBox();
+    glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+    glDepthMask( GL_FALSE );
+    uint32_t issued = 0;
+    for (const OcclusionQueryBox& box : frame.mQueryBoxes)
+    {
+        if (!queries.Begin( box.mProp ))
+            break;
+        shader->set( gGameState->mQueryBoxMin, box.mMin );
+        shader->set( gGameState->mQueryBoxMax, box.mMax );
+        queries.DrawBox();
+        queries.End();
+        issued++;
+    }
+    glDepthMask( GL_TRUE );
+    glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+    return issued;
+}
+
+//=============================================================================
+
+void RenderFrame( FrameSnapshot& frame )
+{
+    if (frame.mFramebufferSize != gGameState->mViewportSize)
+    {
+        gGameState->mViewportSize = frame.mFramebufferSize;
+        glViewport( 0, 0, frame.mFramebufferSize.x, frame.mFramebufferSize.y );
+    }
+
     //glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     glEnable( GL_DEPTH_TEST );
 
-    // Set shader constants.
-    PrepareShader( shader );
+    // Everything streamed to the GPU is written into this frame's region of the stream buffer
+    // before the draws. A region too small for the frame regrows at the next BeginFrame; until
+    // then the frame is only cleared, rather than drawn with data that didn't fit.
+    // Culled on the GPU, the props' commands and instances are the compute pass's output.
+    StreamBuffer& stream = gGameState->mStream;
+    stream.BeginFrame();
+    uint32_t instanceBase = 0;
+    uint32_t drawBase = 0;
+    GpuCullRanges cullRanges;
+    bool const gpuCull = frame.mGpuCull && gGameState->mGpuCulling.IsCreated();
+    bool streamed = WriteFrameBlocks( frame ) && WriteInstances( frame, instanceBase );
+    drawBase = instanceBase;
+    streamed = streamed && (!gpuCull || WriteCullBuffers( frame, instanceBase, cullRanges, drawBase ));
+    bool const multiDraw = streamed && frame.mMultiDraw && BuildIndirectCommands( frame, drawBase );
+    streamed = streamed && (!gpuCull || (multiDraw && WriteCommandModels( frame, cullRanges )));
+    stream.Flush();
+    FrameResults& results = frame.mResults;
+    results.mRender = RenderStats{ 0, 0, 0, 0, 0, 0 };
+    results.mQueriesIssued = 0;
+    if (streamed)
+    {
+        if (gpuCull)
+        {
+            gGameState->mGpuCulling.Cull( stream.GetBuffer(), cullRanges, frame.mCullParams.mInstanceCount, gGameState->mIndirectCount );
+        }
+        ExecuteRenderQueue( frame, multiDraw, drawBase, results.mRender );
+        results.mQueriesIssued = IssueOcclusionQueries( frame );
+    }
+    stream.EndFrame();
 
-    // Render objects
-    for (const auto& obj : gGameState->mObjects)
+    // The next frame's compute pass tests against this one's depth; a frame drawn without
+    // it leaves nothing current to test against.
+    if (gpuCull && streamed)
+    {
+        gGameState->mGpuCulling.BuildPyramid( frame.mFramebufferSize, frame.mCamera.mProjection * frame.mCamera.mView );
+    }
+    else
     {
-        obj->Render();
+        gGameState->mGpuCulling.InvalidatePyramid();
     }
 
+    // Whatever earlier frames' queries have answered by now goes back with this frame.
+    frame.mQueryResults.clear();
+    gGameState->mOcclusionQueries.Collect( [&frame]( PropHandle const prop, bool const visible )
+    {
+        frame.mQueryResults.push_back( OcclusionQueryResult{ prop, visible } );
+    } );
+    results.mQueriesPending = gGameState->mOcclusionQueries.GetPending();
+
+    // Report this frame's bind counts and stream use back for the title.
+    results.mGL = GetGLState().GetStats();
+    results.mStreamUsed = stream.GetUsed();
+    results.mStreamSize = stream.GetFrameSize();
+    results.mStreamWaits = stream.GetWaitCount();
+    GetGLState().ResetStats();
+
     // Swap buffers.
     glfwSwapBuffers( gGameState->mWindow );
 }
 
 //=============================================================================
 
+void RenderThreadMain()
+{
+    // The render thread owns the GL context from here until shutdown, and draws
+    // frame N while the main thread simulates and builds frame N + 1.
+    glfwMakeContextCurrent( gGameState->mWindow );
+    while (FrameSnapshot* const frame = gGameState->mFrames.BeginRead())
+    {
+        RenderFrame( *frame );
+        gGameState->mFrames.EndRead();
+    }
+
+    // the GPU is done with everything before the context goes back for cleanup
+    glFinish();
+    glfwMakeContextCurrent( nullptr );
+}
+
+//=============================================================================
+
+void UpdateFrameStats()
+{
+    double const now = glfwGetTime();
+    if (now - gGameState->mStatsTime < STATS_INTERVAL)
+        return;
+    gGameState->mStatsTime = now;
+
+    FrameArena& arena = GetFrameArena();
+    const FrameResults& results = gGameState->mLastResults;
+    const RenderStats& render = results.mRender;
+    const GLStateStats& gl = results.mGL;
+    const char* aimed = gGameState->mAimedProp != ~0u ? arena.Format( "prop %u", gGameState->mAimedProp ) : "nothing";
+    const char* title = arena.Format( "LearnOpenGL - %s, %s, %u objects in %u draws, %u objects / %u meshes culled, %u occluded, %u lit props, aiming at %s, %s %u issued / %u in flight, %u program / %u material / %u mesh binds, %u GL bind calls (%u filtered), stream %zu/%zu KB (%u stalls), %llu heap allocs/frame, frame arena %zu/%zu KB",
+                                      gGameState->mMultiDraw ? "multi draw (M)" : "per mesh (M)", gGameState->mGpuCull && gGameState->mMultiDraw ? "props culled on GPU (G)" : "props culled on CPU (G)", render.mInstances, render.mDraws, gGameState->mCulledObjects, gGameState->mCulledMeshes, gGameState->mOccludedObjects, gGameState->mLitProps, aimed,
+                                      gGameState->mQueries ? "occlusion queries (O)" : "no occlusion queries (O)", results.mQueriesIssued, results.mQueriesPending, render.mProgramBinds, render.mMaterialBinds, render.mMeshBinds, gl.GetIssued(), gl.mFiltered,
+                                      results.mStreamUsed / 1024, results.mStreamSize / 1024, results.mStreamWaits,
+                                      (unsigned long long)gGameState->mFrameAllocs, arena.GetPeak() / 1024, arena.GetCapacity() / 1024 );
+    glfwSetWindowTitle( gGameState->mWindow, title );
+}
+
+//=============================================================================
+
 int main()
 {
     // initialize OpenGL (3.3 Core Profile)
@@ -504,31 +1482,92 @@ int main()
         return -1;
     }
 
-    // create shader program
-    std::shared_ptr<Shader> modelShader( new Shader( "shaders/model.vs", "shaders/model.fs" ) );
+    // create shader programs
+    RenderProgram* const programs = gGameState->mPrograms;
+    programs[RENDER_PROGRAM_MODEL].mShader = gGameState->mShaders.Create( "shaders/model.vs", "shaders/model.fs" );
+    programs[RENDER_PROGRAM_INSTANCED].mShader = gGameState->mShaders.Create( "shaders/model.vs", "shaders/model.fs", "#define INSTANCED\n" );
+    for (RenderProgram& program : gGameState->mPrograms)
+    {
+        program.mUniforms.Resolve( *gGameState->mShaders.Get( program.mShader ) );
+    }
+    gGameState->mQueryShader = gGameState->mShaders.Create( "shaders/occlusionquery.vs", "shaders/occlusionquery.fs" );
+    {
+        const Shader& shader = *gGameState->mShaders.Get( gGameState->mQueryShader );
+        gGameState->mQueryBoxMin = shader.getUniform<glm::vec3>( "boxMin" );
+        gGameState->mQueryBoxMax = shader.getUniform<glm::vec3>( "boxMax" );
+        shader.bindUniformBlock( "Camera", CAMERA_BLOCK_BINDING );
+    }
+    gGameState->mOcclusionQueries.Create( OCCLUSION_QUERY_CAPACITY );
 
     // load models
     // -----------
-    std::shared_ptr<Model> propModelA( new Model( "objects/nanosuit/nanosuit.obj" ) );
-    std::shared_ptr<Model> propModelB( new Model( "objects/cyborg/cyborg.obj" ) );
+    for (const PropModelDesc& desc : PROP_MODELS)
+    {
+        gGameState->mPropModels.push_back( gGameState->mModels.Create( desc.mPath ) );
+    }
+
+    // props are culled by their model's bounding sphere, and hide others behind their model's torso box
+    for (uint32_t m = 0; m < (uint32_t)gGameState->mPropModels.size(); m++)
+    {
+        const Bounds& bounds = gGameState->mModels.Get( gGameState->mPropModels[m] )->bounds;
+        gGameState->mProps.SetModelBounds( m, bounds.mCenter, bounds.mRadius );
+        gGameState->mProps.SetModelOccluder( m, PROP_MODELS[m].mOccluderMin, PROP_MODELS[m].mOccluderMax );
+    }
+    gGameState->mProps.mQueryBudget = OCCLUSION_QUERY_BUDGET;
+
+    // the compute pass culls props of up to GpuCullParams::MAX_MODELS models; more stay on the CPU
+    gGameState->mGpuCullSupported = gGameState->mGpuCullSupported && gGameState->mPropModels.size() <= GpuCullParams::MAX_MODELS;
+    gGameState->mGpuCull = gGameState->mGpuCullSupported;
+    if (gGameState->mGpuCullSupported)
+    {
+        gGameState->mGpuCulling.Create( "shaders/gpucull.cs", "shaders/gpucommands.cs", "shaders/depthpyramid.cs" );
+    }
 
     // create floor mesh
-    std::shared_ptr<Model> floorModel( new Model( "objects/floor/floor.obj" ) );
+    ModelHandle const floorModel = gGameState->mModels.Create( "objects/floor/floor.obj" );
 
-    // create camera object
-    gGameState->mObjects.push_back( std::shared_ptr<Object>( new Camera() ) );
+    // resolve every material against each program's samplers now, not per draw
+    for (const RenderProgram& program : gGameState->mPrograms)
+    {
+        const Shader& shader = *gGameState->mShaders.Get( program.mShader );
+        gGameState->mModels.ForEach( [&shader]( Model& model ) { model.BindMaterials( shader ); } );
+    }
 
-    // create floor object
-    gGameState->mObjects.push_back( std::shared_ptr<Object>( new Floor( floorModel, modelShader ) ) );
+    // number the meshes and materials for the render queue's sort keys
+    std::map<std::vector<unsigned int>, uint32_t> materialIds;
+    for (ModelHandle const model : gGameState->mPropModels)
+    {
+        RegisterModelMeshes( model, materialIds );
+    }
+    RegisterModelMeshes( floorModel, materialIds );
 
-    // create prop object
-    uint32_t const numProps = 150;
-    for (uint32_t i = 0; i < numProps; i++)
+    // pack all meshes into the geometry arena for multi draw indirect
+    if (gGameState->mMultiDrawSupported)
     {
-        uint32_t const modelIndex = rand() % 2;
-        gGameState->mObjects.push_back( std::shared_ptr<Object>( new Prop( modelIndex == 0 ? propModelA : propModelB, modelShader, modelIndex == 0 ? 0.125f : 0.5f ) ) );
+        gGameState->mGeometry.Upload();
     }
 
+    // create camera entity
+    gGameState->mCamera = CreateCamera( glm::vec3( 0.0f, 13.0f, 23.0f ), glm::vec2( 0.0f, -28.0f ) );
+
+    // create floor entity
+    CreateFloor( floorModel );
+
+    // create props; they live in the PropSystem's own SoA arrays rather than the entity world, which keeps
+    // their SIMD kernels. Each prop's numbers depend only on its id, so spawning runs in parallel.
+    gGameState->mProps.Reserve( NUM_PROPS );
+    gGameState->mProps.Spawn( NUM_PROPS, gGameState->mJobs, []( uint32_t const id, glm::vec2& posXZ, glm::vec2& velocityXZ, float& scale, uint32_t& modelIndex )
+    {
+        // a random angle rather than a random vector, which could come out zero and not normalize
+        Random rng( RANDOM_SEED, RANDOM_PROP_SPAWN, 0, id );
+        modelIndex = rng.NextBelow( 2 );
+        posXZ.x = -FLOOR_HALF_SIZE + (rng.NextFloat() * FLOOR_SIZE);
+        posXZ.y = -FLOOR_HALF_SIZE + (rng.NextFloat() * FLOOR_SIZE);
+        float const angle = rng.NextFloat() * glm::two_pi<float>();
+        velocityXZ = glm::vec2( std::sin( angle ), std::cos( angle ) );
+        scale = modelIndex == 0 ? 0.125f : 0.5f;
+    } );
+
     // create lights
     uint32_t const numColors = 6;
     float const lightPower = 10.0f;
@@ -544,27 +1583,104 @@ int main()
     uint32_t const numLights = 10;
     for (uint32_t i = 0; i < numLights; i++)
     {
-        std::shared_ptr<Light> light( new Light( colors[rand() % numColors] * lightPower ) );
-        gGameState->mObjects.push_back( light );
-        gGameState->mLights.push_back( light );
+        Random rng( RANDOM_SEED, RANDOM_LIGHT_COLOR, 0, i );
+        CreateLight( i, colors[rng.NextBelow( numColors )] * lightPower );
     }
 
+    // size the render queue for every draw up front, so submitting never reallocates
+    uint32_t maxMeshes = 0;
+    for (const MeshRange& range : gGameState->mModelMeshes)
+    {
+        maxMeshes = range.mCount > maxMeshes ? range.mCount : maxMeshes;
+    }
+    uint32_t const numItems = (uint32_t)gGameState->mPropModels.size() + gGameState->mWorld.GetStore<Renderable>().GetCount();
+    for (uint32_t i = 0; i < FramePipeline<FrameSnapshot>::SLOT_COUNT; i++)
+    {
+        FrameSnapshot& frame = gGameState->mFrames.GetSlot( i );
+        frame.mInstances.reserve( NUM_PROPS );
+        frame.mDrawItems.reserve( numItems );
+        frame.mRenderQueue.Reserve( numItems * maxMeshes );
+        frame.mQueryBoxes.reserve( OCCLUSION_QUERY_BUDGET );
+        frame.mQueryResults.reserve( OCCLUSION_QUERY_CAPACITY );
+    }
+
+    // the stream buffer holds a frame's uniform blocks, instances and indirect commands at the most,
+    // and for GPU culling the visible instances, counts and command models besides
+    GLint uniformBufferAlign = 256;
+    glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBufferAlign );
+    gGameState->mUniformBufferAlign = (size_t)uniformBufferAlign;
+    GLint storageBufferAlign = 0;
+    if (gGameState->mGpuCullSupported)
+    {
+        glGetIntegerv( GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageBufferAlign );
+    }
+    gGameState->mStorageBufferAlign = std::max( (size_t)storageBufferAlign, sizeof( glm::vec4 ) );
+    size_t const blockSize = sizeof( CameraBlock ) + sizeof( LightBlock ) + 2 * gGameState->mUniformBufferAlign;
+    size_t const numCommands = numItems * maxMeshes;
+    size_t const cullSize = sizeof( GpuCullParams ) + sizeof( glm::vec4 ) * NUM_PROPS + sizeof( uint32_t ) * (GpuCullParams::MAX_MODELS + numCommands) + 4 * gGameState->mStorageBufferAlign;
+    gGameState->mStream.Create( blockSize + sizeof( glm::vec4 ) * NUM_PROPS + sizeof( DrawElementsIndirectCommand ) * numCommands + 2 * gGameState->mStorageBufferAlign + cullSize );
+
+    // hand the GL context over to the render thread; from here on this thread only
+    // simulates and builds frame snapshots
+    glfwMakeContextCurrent( nullptr );
+    gGameState->mRenderThread = std::thread( RenderThreadMain );
+
     // game loop
     // -----------
+    float const tickTime = 1.0f / SIM_TICK_RATE;
+    double accumulator = 0.0;
     double t0 = glfwGetTime();
     while (!glfwWindowShouldClose(gGameState->mWindow))
     {
+        uint64_t const frameAllocStart = gHeapAllocCount.load( std::memory_order_relaxed );
+
         // update
         double const t1 = glfwGetTime();
         Update( (float)(t1 - t0) );
+        if (!gGameState->mPaused)
+        {
+            accumulator += t1 - t0;
+        }
         t0 = t1;
 
-        // render objects (View Frustum Culling, Occlusion Culling, Draw Order Sorting, etc)
-        Render( modelShader );
+        // simulate in fixed ticks; after a hitch drop whatever the step cap can't absorb
+        uint32_t steps = 0;
+        while (accumulator >= tickTime && steps < SIM_MAX_STEPS_PER_FRAME)
+        {
+            Simulate( tickTime );
+            accumulator -= tickTime;
+            steps++;
+        }
+        if (accumulator >= tickTime)
+        {
+            accumulator = std::fmod( accumulator, (double)tickTime );
+        }
+        gGameState->mInterpolation = (float)(accumulator / tickTime);
+
+        // build the frame for the render thread (View Frustum Culling, Occlusion Culling, etc; draws
+        // sorted by state); waits while the render thread is still a whole frame behind. The slot
+        // comes back with the results of the last frame drawn from it.
+        FrameSnapshot* const frame = gGameState->mFrames.BeginWrite();
+        gGameState->mLastResults = frame->mResults;
+        ApplyQueryResults( *frame );
+        BuildFrame( *frame );
+        gGameState->mFrames.EndWrite();
+
+        // everything transient from this frame goes at once
+        UpdateFrameStats();
+        GetFrameArena().Reset();
+        gGameState->mFrameAllocs = gHeapAllocCount.load( std::memory_order_relaxed ) - frameAllocStart;
 
         gGameState->mFrame++;
     }
 
+    // stop the render thread and take the context back: game state owns GL objects,
+    // so it goes while the context is current
+    gGameState->mFrames.Quit();
+    gGameState->mRenderThread.join();
+    glfwMakeContextCurrent( gGameState->mWindow );
+    gGameState.reset();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -0,0 +1,425 @@
+//=============================================================================
+// Lesson4: Rasterization Stage
+//=============================================================================
+//
+// Headless check of GpuCulling and StreamBuffer against a CPU reference, for
+// drivers the lesson itself can't open a window on, e.g. Mesa's llvmpipe.
+// It makes a surfaceless EGL context, GL 4.3 core, and runs
+//
+//   split depth    a depth buffer whose left part is near the camera and the
+//                  rest far; every instance whose sphere is in view and not
+//                  entirely behind the near part must survive the cull
+//   empty model    the same instances with a model that has no instances
+//                  between two that do; its count and command stay zero
+//   stream buffer  a few frames culled out of the persistently mapped ring,
+//                  read back through the mapping
+//
+// and prints one line per check and PASS or FAIL; the exit code is the
+// number of failed checks. Not part of the CMake build, which needs GLFW and
+// a window. From the repository root, on Linux with Mesa's EGL:
+//
+//   g++ -std=c++14 -O1 -ILesson4_RasterizationStage/Headers
+//       -IThirdparty/glad/include -IThirdparty/glm
+//       Lesson4_RasterizationStage/Tools/gpucullcheck.cpp
+//       Thirdparty/glad/src/glad.c -lEGL -ldl
+//       -o Lesson4_RasterizationStage/Build/gpucullcheck
+//   cd Lesson4_RasterizationStage/Bin
+//   EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 ../Build/gpucullcheck
+//
+// It runs from Bin like the lesson, for the shaders/ paths.
+//=============================================================================
+
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <frustum.h>
+#include <gpuculling.h>
+#include <streambuffer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <tuple>
+#include <vector>
+
+//=============================================================================
+
+const int DEPTH_WIDTH = 201;            // odd, so pyramid levels round
+const int DEPTH_HEIGHT = 151;
+const int DEPTH_SPLIT = 100;            // columns left of this are near
+const float DEPTH_NEAR = 0.3f;          // their depth; the rest is cleared to 1
+const uint32_t INSTANCE_COUNT = 20000;
+const float INSTANCE_SPREAD = 40.0f;    // instances lie in [-spread, spread] on xz
+const float INSTANCE_SCALE = 0.5f;
+const uint32_t STREAM_FRAMES = 5;
+
+//=============================================================================
+
+void* GetProcAddress( const char* name )
+{
+    return (void*)eglGetProcAddress( name );
+}
+
+bool MakeContext()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC const getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+    EGLDisplay const display = getPlatformDisplay != nullptr ? getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr ) : eglGetDisplay( EGL_DEFAULT_DISPLAY );
+    EGLint major, minor;
+    if (!eglInitialize( display, &major, &minor ))
+    {
+        printf( "eglInitialize failed\n" );
+        return false;
+    }
+    eglBindAPI( EGL_OPENGL_API );
+
+    EGLint const configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint configCount = 0;
+    eglChooseConfig( display, configAttribs, &config, 1, &configCount );
+
+    EGLint const contextAttribs[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 3, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext const context = eglCreateContext( display, configCount > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs );
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ))
+    {
+        printf( "no GL 4.3 core context, EGL error 0x%x\n", eglGetError() );
+        return false;
+    }
+    if (!gladLoadGLLoader( (GLADloadproc)GetProcAddress ))
+    {
+        printf( "gladLoadGLLoader failed\n" );
+        return false;
+    }
+    printf( "%s | %s\n", glGetString( GL_RENDERER ), glGetString( GL_VERSION ) );
+    return true;
+}
+
+//=============================================================================
+
+glm::mat4 ViewProjection( float const aspect )
+{
+    return glm::perspective( glm::radians( 45.0f ), aspect, 0.1f, 100.0f ) * glm::lookAt( glm::vec3( 0.0f, 13.0f, 23.0f ), glm::vec3( 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+}
+
+// An instance's bounding sphere in world space, placed like shaders/gpucull.cs does.
+void InstanceSphere( const glm::vec4& instance, const glm::vec4& modelSphere, glm::vec3& center, float& radius )
+{
+    float const s = sinf( instance.z );
+    float const c = cosf( instance.z );
+    glm::vec3 const local = glm::vec3( modelSphere ) * instance.w;
+    center = glm::vec3( instance.x + c * local.x + s * local.z, local.y, instance.y + c * local.z - s * local.x );
+    radius = modelSphere.w * instance.w;
+}
+
+// True if the sphere's screen box reaches the far part of the depth buffer, or
+// its nearest point is in front of the near part, or it reaches behind the
+// camera: the pyramid can't hide it.
+bool MustBeVisible( const glm::mat4& viewProjection, const glm::vec3& center, float const radius )
+{
+    float maxX = -1.0f;
+    float nearest = 1.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 const offset( corner & 1 ? radius : -radius, corner & 2 ? radius : -radius, corner & 4 ? radius : -radius );
+        glm::vec4 const clip = viewProjection * glm::vec4( center + offset, 1.0f );
+        if (clip.w <= 1e-4f || clip.z < -clip.w)
+            return true;
+        glm::vec3 const ndc = glm::vec3( clip ) / clip.w;
+        maxX = std::max( maxX, ndc.x * 0.5f + 0.5f );
+        nearest = std::min( nearest, ndc.z * 0.5f + 0.5f );
+    }
+    return maxX * DEPTH_WIDTH >= DEPTH_SPLIT - 0.01f || nearest <= DEPTH_NEAR;
+}
+
+bool InstanceLess( const glm::vec4& a, const glm::vec4& b )
+{
+    return std::tie( a.x, a.y, a.z ) < std::tie( b.x, b.y, b.z );
+}
+
+GLint StorageAlign()
+{
+    GLint align = 0;
+    glGetIntegerv( GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align );
+    return std::max( align, 1 );
+}
+
+//=============================================================================
+
+// Culls against the split depth buffer with modelCount models, model
+// emptyModel having no instances (modelCount to have none empty), and counts
+// the instances that should have survived but didn't.
+uint32_t CullSplitDepth( GpuCulling& cull, uint32_t const modelCount, uint32_t const emptyModel, bool& countsOk )
+{
+    GLuint framebuffer, color, depth;
+    glGenFramebuffers( 1, &framebuffer );
+    glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+    glGenRenderbuffers( 1, &color );
+    glBindRenderbuffer( GL_RENDERBUFFER, color );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, DEPTH_WIDTH, DEPTH_HEIGHT );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color );
+    glGenRenderbuffers( 1, &depth );
+    glBindRenderbuffer( GL_RENDERBUFFER, depth );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, DEPTH_WIDTH, DEPTH_HEIGHT );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth );
+    glViewport( 0, 0, DEPTH_WIDTH, DEPTH_HEIGHT );
+
+    glClearDepth( 1.0 );
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    glEnable( GL_SCISSOR_TEST );
+    glScissor( 0, 0, DEPTH_SPLIT, DEPTH_HEIGHT );
+    glClearDepth( DEPTH_NEAR );
+    glClear( GL_DEPTH_BUFFER_BIT );
+    glDisable( GL_SCISSOR_TEST );
+    glClearDepth( 1.0 );
+
+    glm::mat4 const viewProjection = ViewProjection( (float)DEPTH_WIDTH / DEPTH_HEIGHT );
+    cull.BuildPyramid( glm::ivec2( DEPTH_WIDTH, DEPTH_HEIGHT ), viewProjection );
+
+    std::mt19937 rng( 5 );
+    std::uniform_real_distribution<float> position( -INSTANCE_SPREAD, INSTANCE_SPREAD );
+    std::uniform_real_distribution<float> heading( 0.0f, 6.28f );
+    std::vector<glm::vec4> instances( INSTANCE_COUNT );
+    for (glm::vec4& instance : instances)
+    {
+        instance = glm::vec4( position( rng ), position( rng ), heading( rng ), INSTANCE_SCALE );
+    }
+
+    // the non empty models share the instances evenly; one command per model
+    // plus one that no model owns, which must be left alone
+    GpuCullParams params = {};
+    Frustum const frustum( viewProjection );
+    for (int i = 0; i < 6; i++)
+    {
+        params.mPlanes[i] = frustum.mPlanes[i];
+    }
+    uint32_t const filled = emptyModel < modelCount ? modelCount - 1 : modelCount;
+    uint32_t next = 0;
+    for (uint32_t m = 0; m < modelCount; m++)
+    {
+        params.mModelSpheres[m] = glm::vec4( 0.1f * m, 1.5f + 0.25f * m, 0.2f, 2.0f - 0.5f * m );
+        params.mModelFirst[m] = next;
+        if (m != emptyModel)
+        {
+            next += INSTANCE_COUNT / filled;
+        }
+    }
+    params.mModelFirst[modelCount] = INSTANCE_COUNT;
+    params.mInstanceCount = INSTANCE_COUNT;
+    params.mModelCount = modelCount;
+    cull.FillParams( params );
+
+    uint32_t const commandCount = modelCount + 1;
+    std::vector<DrawElementsIndirectCommand> commands( commandCount, DrawElementsIndirectCommand{ 36, 77, 0, 0, 0 } );
+    std::vector<uint32_t> commandModels( commandCount, ~0u );
+    for (uint32_t m = 0; m < modelCount; m++)
+    {
+        commands[m].mBaseInstance = params.mModelFirst[m];
+        commandModels[m] = m;
+    }
+
+    size_t const align = StorageAlign();
+    auto const alignUp = [align]( size_t offset ) { return (offset + align - 1) / align * align; };
+    GpuCullRanges ranges;
+    size_t size = 0;
+    ranges.mParams = size;          size = alignUp( size + sizeof( GpuCullParams ) );
+    ranges.mInstances = size;       size = alignUp( size + sizeof( glm::vec4 ) * INSTANCE_COUNT );
+    ranges.mVisible = size;         size = alignUp( size + sizeof( glm::vec4 ) * INSTANCE_COUNT );
+    ranges.mCounts = size;          size = alignUp( size + sizeof( uint32_t ) * GpuCullParams::MAX_MODELS );
+    ranges.mCommands = size;        size = alignUp( size + sizeof( DrawElementsIndirectCommand ) * commandCount );
+    ranges.mCommandModels = size;   size = alignUp( size + sizeof( uint32_t ) * commandCount );
+
+    uint32_t counts[GpuCullParams::MAX_MODELS] = {};
+    GLuint buffer;
+    glGenBuffers( 1, &buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+    glBufferData( GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW );
+    glBufferSubData( GL_ARRAY_BUFFER, ranges.mParams, sizeof( params ), &params );
+    glBufferSubData( GL_ARRAY_BUFFER, ranges.mInstances, sizeof( glm::vec4 ) * INSTANCE_COUNT, instances.data() );
+    glBufferSubData( GL_ARRAY_BUFFER, ranges.mCounts, sizeof( counts ), counts );
+    glBufferSubData( GL_ARRAY_BUFFER, ranges.mCommands, sizeof( DrawElementsIndirectCommand ) * commandCount, commands.data() );
+    glBufferSubData( GL_ARRAY_BUFFER, ranges.mCommandModels, sizeof( uint32_t ) * commandCount, commandModels.data() );
+
+    cull.Cull( buffer, ranges, INSTANCE_COUNT, commandCount );
+    glFinish();
+
+    std::vector<glm::vec4> visible( INSTANCE_COUNT );
+    glGetBufferSubData( GL_ARRAY_BUFFER, ranges.mCounts, sizeof( counts ), counts );
+    glGetBufferSubData( GL_ARRAY_BUFFER, ranges.mCommands, sizeof( DrawElementsIndirectCommand ) * commandCount, commands.data() );
+    glGetBufferSubData( GL_ARRAY_BUFFER, ranges.mVisible, sizeof( glm::vec4 ) * INSTANCE_COUNT, visible.data() );
+
+    // every command draws its model's count, the unowned one is untouched,
+    // and an empty model has nothing to draw
+    countsOk = commands[modelCount].mInstanceCount == 77;
+    for (uint32_t m = 0; m < modelCount; m++)
+    {
+        countsOk = countsOk && commands[m].mInstanceCount == counts[m];
+        countsOk = countsOk && counts[m] <= params.mModelFirst[m + 1] - params.mModelFirst[m];
+    }
+
+    uint32_t missing = 0;
+    for (uint32_t m = 0; m < modelCount; m++)
+    {
+        std::vector<glm::vec4> survivors( visible.begin() + params.mModelFirst[m], visible.begin() + params.mModelFirst[m] + std::min( counts[m], params.mModelFirst[m + 1] - params.mModelFirst[m] ) );
+        std::sort( survivors.begin(), survivors.end(), InstanceLess );
+        for (uint32_t i = params.mModelFirst[m]; i < params.mModelFirst[m + 1]; i++)
+        {
+            glm::vec3 center;
+            float radius;
+            InstanceSphere( instances[i], params.mModelSpheres[m], center, radius );
+            // spheres within rounding of a plane may go either way
+            if (!frustum.IntersectsSphere( center, radius - 1e-3f ))
+                continue;
+            if (MustBeVisible( viewProjection, center, radius ) && !std::binary_search( survivors.begin(), survivors.end(), instances[i], InstanceLess ))
+            {
+                missing++;
+            }
+        }
+    }
+
+    glDeleteBuffers( 1, &buffer );
+    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    glDeleteRenderbuffers( 1, &depth );
+    glDeleteRenderbuffers( 1, &color );
+    glDeleteFramebuffers( 1, &framebuffer );
+    return missing;
+}
+
+//=============================================================================
+
+bool CheckSplitDepth( GpuCulling& cull )
+{
+    bool countsOk;
+    uint32_t const missing = CullSplitDepth( cull, 2, 2, countsOk );
+    printf( "split depth: %u visible instances culled, counts %s\n", missing, countsOk ? "match" : "differ" );
+    return missing == 0 && countsOk;
+}
+
+bool CheckEmptyModel( GpuCulling& cull )
+{
+    bool countsOk;
+    uint32_t const missing = CullSplitDepth( cull, 3, 1, countsOk );
+    printf( "empty model: %u visible instances culled, counts %s\n", missing, countsOk ? "match" : "differ" );
+    return missing == 0 && countsOk;
+}
+
+// Culls a grid through the stream buffer without a pyramid, like a frame
+// after a resize, and reads the commands back through the mapping.
+bool CheckStreamBuffer( GpuCulling& cull )
+{
+    StreamBuffer stream;
+    stream.Create( 1 << 20 );
+    size_t const align = StorageAlign();
+    cull.InvalidatePyramid();
+
+    glm::mat4 const viewProjection = ViewProjection( 4.0f / 3.0f );
+    Frustum const frustum( viewProjection );
+    glm::vec4 const modelSphere( 0.0f, 1.0f, 0.0f, 1.0f );
+    uint32_t const count = 1000;
+    uint32_t const split = 400;
+
+    bool ok = true;
+    for (uint32_t frame = 0; frame < STREAM_FRAMES; frame++)
+    {
+        stream.BeginFrame();
+        StreamAlloc const instances = stream.Alloc( sizeof( glm::vec4 ) * count, align );
+        StreamAlloc const paramsAlloc = stream.Alloc( sizeof( GpuCullParams ), align );
+        StreamAlloc const visible = stream.Alloc( sizeof( glm::vec4 ) * count, align );
+        StreamAlloc const counts = stream.Alloc( sizeof( uint32_t ) * GpuCullParams::MAX_MODELS, align );
+        StreamAlloc const commandsAlloc = stream.Alloc( sizeof( DrawElementsIndirectCommand ) * 2, align );
+        StreamAlloc const commandModels = stream.Alloc( sizeof( uint32_t ) * 2, align );
+
+        // the grid moves each frame, so a stale region would show
+        glm::vec4* const instance = static_cast<glm::vec4*>( instances.mData );
+        uint32_t expected[2] = { 0, 0 };
+        uint32_t possible[2] = { 0, 0 };
+        for (uint32_t i = 0; i < count; i++)
+        {
+            instance[i] = glm::vec4( (i % 40) * 2.0f - 40.0f + frame, (i / 40) * 3.0f - 40.0f, 0.0f, INSTANCE_SCALE );
+            glm::vec3 center;
+            float radius;
+            InstanceSphere( instance[i], modelSphere, center, radius );
+            expected[i < split ? 0 : 1] += frustum.IntersectsSphere( center, radius - 1e-3f ) ? 1 : 0;
+            possible[i < split ? 0 : 1] += frustum.IntersectsSphere( center, radius + 1e-3f ) ? 1 : 0;
+        }
+
+        GpuCullParams& params = *static_cast<GpuCullParams*>( paramsAlloc.mData );
+        memset( &params, 0, sizeof( params ) );
+        for (int i = 0; i < 6; i++)
+        {
+            params.mPlanes[i] = frustum.mPlanes[i];
+        }
+        params.mModelSpheres[0] = modelSphere;
+        params.mModelSpheres[1] = modelSphere;
+        params.mModelFirst[0] = 0;
+        params.mModelFirst[1] = split;
+        params.mModelFirst[2] = count;
+        params.mInstanceCount = count;
+        params.mModelCount = 2;
+        cull.FillParams( params );
+        memset( counts.mData, 0, sizeof( uint32_t ) * GpuCullParams::MAX_MODELS );
+
+        DrawElementsIndirectCommand* const commands = static_cast<DrawElementsIndirectCommand*>( commandsAlloc.mData );
+        commands[0] = DrawElementsIndirectCommand{ 36, split, 0, 0, 0 };
+        commands[1] = DrawElementsIndirectCommand{ 36, count - split, 0, 0, split };
+        static_cast<uint32_t*>( commandModels.mData )[0] = 0;
+        static_cast<uint32_t*>( commandModels.mData )[1] = 1;
+        stream.Flush();
+
+        GpuCullRanges const ranges = { paramsAlloc.mOffset, instances.mOffset, visible.mOffset, counts.mOffset, commandsAlloc.mOffset, commandModels.mOffset };
+        cull.Cull( stream.GetBuffer(), ranges, count, 2 );
+        glFinish();
+
+        // without a persistent mapping the commands are only in the buffer
+        uint32_t drawn[2] = { commands[0].mInstanceCount, commands[1].mInstanceCount };
+        if (!stream.IsPersistent())
+        {
+            DrawElementsIndirectCommand readBack[2];
+            glBindBuffer( GL_ARRAY_BUFFER, stream.GetBuffer() );
+            glGetBufferSubData( GL_ARRAY_BUFFER, ranges.mCommands, sizeof( readBack ), readBack );
+            drawn[0] = readBack[0].mInstanceCount;
+            drawn[1] = readBack[1].mInstanceCount;
+        }
+        for (int m = 0; m < 2; m++)
+        {
+            ok = ok && expected[m] <= drawn[m] && drawn[m] <= possible[m];
+        }
+        printf( "stream buffer frame %u: drew %u %u of %u-%u %u-%u\n", frame, drawn[0], drawn[1], expected[0], possible[0], expected[1], possible[1] );
+        stream.EndFrame();
+    }
+    printf( "stream buffer: %s mapping\n", stream.IsPersistent() ? "persistent" : "copied" );
+    return ok;
+}
+
+//=============================================================================
+
+int main()
+{
+    if (!MakeContext())
+        return 1;
+    if (!GpuCulling::IsSupported())
+    {
+        printf( "GL 4.3 unavailable\n" );
+        return 1;
+    }
+
+    GpuCulling cull;
+    cull.Create( "shaders/gpucull.cs", "shaders/gpucommands.cs", "shaders/depthpyramid.cs" );
+
+    int failed = 0;
+    failed += CheckSplitDepth( cull ) ? 0 : 1;
+    failed += CheckEmptyModel( cull ) ? 0 : 1;
+    failed += CheckStreamBuffer( cull ) ? 0 : 1;
+    GLenum const error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        printf( "GL error 0x%x\n", error );
+        failed++;
+    }
+    printf( "%s\n", failed == 0 ? "PASS" : "FAIL" );
+    return failed;
+}